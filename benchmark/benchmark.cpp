@@ -0,0 +1,466 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "../include/timer.h"
+#include "../include/vector.h"
+#include "../include/matrix.h"
+#include "../include/image.h"
+#include "../include/utils.h"
+#include "../include/mesh.h"
+#include "../include/renderer.h"
+
+/**
+ * Headless benchmark of all Z-Buffer algorithms.
+ * The mesh is loaded once, then every combination of algorithm, instance
+ * grid, projection and camera path is rendered for a fixed number of frames.
+ * Camera paths only depend on the frame index, so runs are reproducible.
+ * octzf keeps the octree of each instance built in the first frame, so it
+ * only runs with the static camera.
+ * -------------------------------------------------------
+ * To compile:
+        use command: 'make benchmark' in MacOS
+        or 'mingw32-make benchmark' in Window
+ * To Run:
+        Options:
+        -i              Model to load, .obj format.
+        -z              Only run the given algorithm, can be repeated:
+            simple | scanline | hiez | octz | octzf
+        -c s n          Only run the s * s * n grid, can be repeated,
+                        default to 1 1, 3 3 and 5 3;
+        -n              Timed frames per configuration, default to 30;
+        -r              Rasterization precision, pixel or subpixel, default to pixel;
+        -l              Meshlet culling, on or off, default to on;
+        -k              Vertex cache reordering on load, on or off, default to on;
+        -t              Two-phase occlusion culling, on or off, default to off;
+        -x              Occluder pass, on or off, default to off;
+        -s              Share vertex transform across instances, on or off, default to on;
+        -e              Levels of detail, on or off, default to off;
+        -a              Samples per pixel (simple), 1, 4 or 8, default to 1;
+        -q b p          Depth storage of the base level, f32, u24 or u16, and of
+                        the pyramid, f32, u16 or u8, default to f32 f32;
+        -o              Output file, .json for JSON, otherwise CSV,
+                        default to CSV on standard output.
+ * Samples:
+        ./bench -i meshes/spot.obj
+        ./bench -i meshes/spot.obj -z hiez -z octz -c 5 3 -o result.json
+ */
+
+int const scr_w = 512;
+int const scr_h = 512;
+
+// Untimed frames before each configuration, also builds octree cache of octzf.
+int const warmup_frames = 2;
+
+enum struct CameraPath {
+    Static, // front view
+    Orbit,  // one turn around y-axis
+    Tumble, // turn around y-axis while nodding around x-axis
+    Dolly,  // move from far to near
+};
+
+struct Config {
+    ZBufferAlgorithm algorithm;
+    int grid[2];
+    ProjectionMode proj_mode;
+    CameraPath path;
+    RasterPrecision precision;
+    bool cull_meshlets;
+    bool reorder;
+    bool two_phase;
+    bool occluder_pass;
+    bool share_transform;
+    bool lod;
+    int samples;
+    DepthFormat depth_format;
+    DepthFormat pyramid_format;
+};
+
+struct Result {
+    Config config;
+    long long triangles; // triangles submitted per frame, mean over timed frames
+    int instances;
+    int frames;
+    double mean;   // ms
+    double median; // ms
+    double p99;    // ms
+    // Depth tests and writes of an extra untimed frame, in total and per
+    // covered pixel.
+    long long tests;
+    long long writes;
+    double tests_per_pixel;
+    double writes_per_pixel;
+};
+
+static const char* algorithmName(ZBufferAlgorithm algorithm) {
+    switch (algorithm) {
+    case ZBufferAlgorithm::SimpleZBuffer:       return "simple";
+    case ZBufferAlgorithm::ScanlineZBuffer:     return "scanline";
+    case ZBufferAlgorithm::HierarchicalZBuffer: return "hiez";
+    case ZBufferAlgorithm::OctreeZBuffer:       return "octz";
+    case ZBufferAlgorithm::OctreeZBufferFixed:  return "octzf";
+    }
+    return "";
+}
+
+static const char* projectionName(ProjectionMode mode) {
+    return mode == ProjectionMode::Perspective ? "perspective" : "orthogonal";
+}
+
+static const char* precisionName(RasterPrecision precision) {
+    return precision == RasterPrecision::Subpixel ? "subpixel" : "pixel";
+}
+
+static const char* pathName(CameraPath path) {
+    switch (path) {
+    case CameraPath::Static: return "static";
+    case CameraPath::Orbit:  return "orbit";
+    case CameraPath::Tumble: return "tumble";
+    case CameraPath::Dolly:  return "dolly";
+    }
+    return "";
+}
+
+static const char* depthFormatName(DepthFormat format) {
+    switch (format) {
+    case DepthFormat::Float32: return "f32";
+    case DepthFormat::Unorm24: return "u24";
+    case DepthFormat::Unorm16: return "u16";
+    case DepthFormat::Unorm8:  return "u8";
+    }
+    return "";
+}
+
+// t goes from 0 to 1 over the timed frames.
+static Camera cameraAt(CameraPath path, float t) {
+    Camera camera;
+    switch (path) {
+    case CameraPath::Static:
+        break;
+    case CameraPath::Orbit:
+        camera.rotate_y = PI_mul_two() * t;
+        break;
+    case CameraPath::Tumble:
+        camera.rotate_y = PI_mul_two() * t;
+        camera.rotate_x = 0.5f * std::sin(PI_mul_two() * t);
+        break;
+    case CameraPath::Dolly:
+        camera.z = -10.0f + 6.0f * t;
+        break;
+    }
+    return camera;
+}
+
+static Result run(Config const& config, TriangleMesh const& mesh, std::vector<color8> const& colors, int frame_count) {
+    // Fresh rasterizers for each configuration, octzf caches octrees per instance.
+    std::unique_ptr<Renderer> renderer(new Renderer(scr_w, scr_h));
+    renderer->setSubpixel(config.precision == RasterPrecision::Subpixel);
+    renderer->setCullMeshlets(config.cull_meshlets);
+    renderer->setTwoPhase(config.two_phase);
+    renderer->setOccluderPass(config.occluder_pass);
+    renderer->setShareTransform(config.share_transform);
+    renderer->setLOD(config.lod);
+    renderer->setSamples(config.samples);
+    renderer->setDepthFormat(config.depth_format, config.pyramid_format);
+    Image image(scr_w, scr_h);
+
+    int c = config.grid[0] / 2;
+    int n = config.grid[1];
+
+    Result result;
+    result.config = config;
+    result.frames = frame_count;
+
+    std::vector<double> times;
+    long long triangles = 0;
+    Timer t;
+    for (int i = -warmup_frames; i < frame_count; ++i) {
+        auto camera = cameraAt(config.path, i < 0 ? 0.0f : (float)i / frame_count);
+        auto proj = projection(config.proj_mode, camera, scr_w, scr_h);
+
+        image.fill(colorf{0, 0, 0, 1});
+
+        t.update();
+        result.instances = renderer->drawGrid(config.algorithm, mesh, colors, proj, camera, c, n, image);
+        t.update();
+
+        if (i >= 0) {
+            times.push_back(t.deltaTime() * 1000);
+            triangles += renderer->submitted_triangles;
+        }
+    }
+    // Mean per frame, levels of detail change along the camera path.
+    result.triangles = triangles / frame_count;
+
+    // Overdraw is counted separately so that it does not affect the timing.
+    renderer->setCountOverdraw(true);
+    auto camera = cameraAt(config.path, (float)(frame_count - 1) / frame_count);
+    auto proj = projection(config.proj_mode, camera, scr_w, scr_h);
+    renderer->drawGrid(config.algorithm, mesh, colors, proj, camera, c, n, image);
+    auto const& overdraw = renderer->overdrawBuffer(config.algorithm);
+    auto covered = std::max(overdraw.coveredPixels(), 1LL);
+    result.tests = overdraw.totalTests();
+    result.writes = overdraw.totalWrites();
+    result.tests_per_pixel = (double)overdraw.totalTests() / covered;
+    result.writes_per_pixel = (double)overdraw.totalWrites() / covered;
+
+    double total = 0.0;
+    for (auto time : times) total += time;
+    std::sort(times.begin(), times.end());
+    result.mean = total / frame_count;
+    result.median = frame_count % 2 ? times[frame_count / 2]
+                                    : (times[frame_count / 2 - 1] + times[frame_count / 2]) / 2;
+    // Nearest-rank percentile.
+    result.p99 = times[(int)std::ceil(0.99 * frame_count) - 1];
+    return result;
+}
+
+static void writeCSV(std::ostream & out, std::vector<Result> const& results) {
+    out << "algorithm,grid,layers,projection,camera,raster,meshlets,reorder,two_phase,occluders,shared_transform,lod,samples,depth,pyramid,triangles,instances,frames,"
+           "mean_ms,median_ms,p99_ms,triangles_per_s,tests_per_s,writes_per_s,"
+           "tests_per_pixel,writes_per_pixel\n";
+    for (auto const& r : results) {
+        out << algorithmName(r.config.algorithm) << ','
+            << r.config.grid[0] << ',' << r.config.grid[1] << ','
+            << projectionName(r.config.proj_mode) << ','
+            << pathName(r.config.path) << ','
+            << precisionName(r.config.precision) << ','
+            << (r.config.cull_meshlets ? "on" : "off") << ','
+            << (r.config.reorder ? "on" : "off") << ','
+            << (r.config.two_phase ? "on" : "off") << ','
+            << (r.config.occluder_pass ? "on" : "off") << ','
+            << (r.config.share_transform ? "on" : "off") << ','
+            << (r.config.lod ? "on" : "off") << ','
+            << r.config.samples << ','
+            << depthFormatName(r.config.depth_format) << ','
+            << depthFormatName(r.config.pyramid_format) << ','
+            << r.triangles << ',' << r.instances << ',' << r.frames << ','
+            << r.mean << ',' << r.median << ',' << r.p99 << ','
+            << r.triangles * 1000 / r.mean << ','
+            << (double)r.tests * 1000 / r.mean << ','
+            << (double)r.writes * 1000 / r.mean << ','
+            << r.tests_per_pixel << ',' << r.writes_per_pixel << '\n';
+    }
+}
+
+static void writeJSON(std::ostream & out, std::vector<Result> const& results) {
+    out << "{\n";
+    out << "  \"width\": " << scr_w << ",\n";
+    out << "  \"height\": " << scr_h << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto const& r = results[i];
+        out << "    {"
+            << "\"algorithm\": \"" << algorithmName(r.config.algorithm) << "\", "
+            << "\"grid\": " << r.config.grid[0] << ", "
+            << "\"layers\": " << r.config.grid[1] << ", "
+            << "\"projection\": \"" << projectionName(r.config.proj_mode) << "\", "
+            << "\"camera\": \"" << pathName(r.config.path) << "\", "
+            << "\"raster\": \"" << precisionName(r.config.precision) << "\", "
+            << "\"meshlets\": \"" << (r.config.cull_meshlets ? "on" : "off") << "\", "
+            << "\"reorder\": \"" << (r.config.reorder ? "on" : "off") << "\", "
+            << "\"two_phase\": \"" << (r.config.two_phase ? "on" : "off") << "\", "
+            << "\"occluders\": \"" << (r.config.occluder_pass ? "on" : "off") << "\", "
+            << "\"shared_transform\": \"" << (r.config.share_transform ? "on" : "off") << "\", "
+            << "\"lod\": \"" << (r.config.lod ? "on" : "off") << "\", "
+            << "\"samples\": " << r.config.samples << ", "
+            << "\"depth\": \"" << depthFormatName(r.config.depth_format) << "\", "
+            << "\"pyramid\": \"" << depthFormatName(r.config.pyramid_format) << "\", "
+            << "\"triangles\": " << r.triangles << ", "
+            << "\"instances\": " << r.instances << ", "
+            << "\"frames\": " << r.frames << ", "
+            << "\"mean_ms\": " << r.mean << ", "
+            << "\"median_ms\": " << r.median << ", "
+            << "\"p99_ms\": " << r.p99 << ", "
+            << "\"triangles_per_s\": " << r.triangles * 1000 / r.mean << ", "
+            << "\"tests_per_s\": " << (double)r.tests * 1000 / r.mean << ", "
+            << "\"writes_per_s\": " << (double)r.writes * 1000 / r.mean << ", "
+            << "\"tests_per_pixel\": " << r.tests_per_pixel << ", "
+            << "\"writes_per_pixel\": " << r.writes_per_pixel
+            << (i + 1 < results.size() ? "},\n" : "}\n");
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+static bool parseAlgorithm(const char* name, ZBufferAlgorithm * algorithm) {
+    ZBufferAlgorithm all[] = {
+        ZBufferAlgorithm::SimpleZBuffer,
+        ZBufferAlgorithm::ScanlineZBuffer,
+        ZBufferAlgorithm::HierarchicalZBuffer,
+        ZBufferAlgorithm::OctreeZBuffer,
+        ZBufferAlgorithm::OctreeZBufferFixed,
+    };
+    for (auto a : all) {
+        if (std::strcmp(name, algorithmName(a)) == 0) {
+            *algorithm = a;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    std::string model;
+    std::string output;
+    int frame_count = 30;
+    RasterPrecision precision = RasterPrecision::Pixel;
+    bool cull_meshlets = true;
+    bool reorder = true;
+    bool two_phase = false;
+    bool occluder_pass = false;
+    bool share_transform = true;
+    bool lod = false;
+    int samples = 1;
+    DepthFormat depth_format = DepthFormat::Float32;
+    DepthFormat pyramid_format = DepthFormat::Float32;
+    std::vector<ZBufferAlgorithm> algorithms;
+    std::vector<std::pair<int, int>> grids;
+
+    int i = 1;
+    while (i < argc) {
+        if (std::strcmp(argv[i], "-i") == 0 && (i < argc - 1)) {
+            model = argv[i + 1];
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-z") == 0 && (i < argc - 1)) {
+            ZBufferAlgorithm algorithm;
+            if (parseAlgorithm(argv[i + 1], &algorithm)) algorithms.push_back(algorithm);
+            else std::cout << "Unknown algorithm: " << argv[i + 1] << std::endl;
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-c") == 0 && (i < argc - 2)) {
+            grids.push_back({ atoi(argv[i + 1]), atoi(argv[i + 2]) });
+            i += 3;
+        }
+        else if (std::strcmp(argv[i], "-n") == 0 && (i < argc - 1)) {
+            frame_count = std::max(1, atoi(argv[i + 1]));
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-r") == 0 && (i < argc - 1)) {
+            if (std::strcmp(argv[i + 1], "subpixel") == 0) precision = RasterPrecision::Subpixel;
+            else if (std::strcmp(argv[i + 1], "pixel") == 0) precision = RasterPrecision::Pixel;
+            else std::cout << "Unknown precision: " << argv[i + 1] << std::endl;
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-l") == 0 && (i < argc - 1)) {
+            if (std::strcmp(argv[i + 1], "on") == 0) cull_meshlets = true;
+            else if (std::strcmp(argv[i + 1], "off") == 0) cull_meshlets = false;
+            else std::cout << "Unknown meshlet culling: " << argv[i + 1] << std::endl;
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-k") == 0 && (i < argc - 1)) {
+            if (std::strcmp(argv[i + 1], "on") == 0) reorder = true;
+            else if (std::strcmp(argv[i + 1], "off") == 0) reorder = false;
+            else std::cout << "Unknown vertex cache reordering: " << argv[i + 1] << std::endl;
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-t") == 0 && (i < argc - 1)) {
+            if (std::strcmp(argv[i + 1], "on") == 0) two_phase = true;
+            else if (std::strcmp(argv[i + 1], "off") == 0) two_phase = false;
+            else std::cout << "Unknown two-phase culling: " << argv[i + 1] << std::endl;
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-x") == 0 && (i < argc - 1)) {
+            if (std::strcmp(argv[i + 1], "on") == 0) occluder_pass = true;
+            else if (std::strcmp(argv[i + 1], "off") == 0) occluder_pass = false;
+            else std::cout << "Unknown occluder pass: " << argv[i + 1] << std::endl;
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-s") == 0 && (i < argc - 1)) {
+            if (std::strcmp(argv[i + 1], "on") == 0) share_transform = true;
+            else if (std::strcmp(argv[i + 1], "off") == 0) share_transform = false;
+            else std::cout << "Unknown shared transform: " << argv[i + 1] << std::endl;
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-e") == 0 && (i < argc - 1)) {
+            if (std::strcmp(argv[i + 1], "on") == 0) lod = true;
+            else if (std::strcmp(argv[i + 1], "off") == 0) lod = false;
+            else std::cout << "Unknown levels of detail: " << argv[i + 1] << std::endl;
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-a") == 0 && (i < argc - 1)) {
+            int n = atoi(argv[i + 1]);
+            if (n == 1 || n == 4 || n == 8) samples = n;
+            else std::cout << "Unknown samples: " << argv[i + 1] << std::endl;
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-q") == 0 && (i < argc - 2)) {
+            if (std::strcmp(argv[i + 1], "f32") == 0) depth_format = DepthFormat::Float32;
+            else if (std::strcmp(argv[i + 1], "u24") == 0) depth_format = DepthFormat::Unorm24;
+            else if (std::strcmp(argv[i + 1], "u16") == 0) depth_format = DepthFormat::Unorm16;
+            else std::cout << "Unknown depth format: " << argv[i + 1] << std::endl;
+            if (std::strcmp(argv[i + 2], "f32") == 0) pyramid_format = DepthFormat::Float32;
+            else if (std::strcmp(argv[i + 2], "u16") == 0) pyramid_format = DepthFormat::Unorm16;
+            else if (std::strcmp(argv[i + 2], "u8") == 0) pyramid_format = DepthFormat::Unorm8;
+            else std::cout << "Unknown pyramid format: " << argv[i + 2] << std::endl;
+            i += 3;
+        }
+        else if (std::strcmp(argv[i], "-o") == 0 && (i < argc - 1)) {
+            output = argv[i + 1];
+            i += 2;
+        }
+        else {
+            i += 1;
+        }
+    }
+
+    if (model.empty()) {
+        std::cout << "Usage: bench -i <model.obj> [-z algorithm]... [-c s n]... [-n frames] [-r precision] [-l on|off] [-k on|off] [-t on|off] [-x on|off] [-s on|off] [-e on|off] [-a samples] [-q base pyramid] [-o output]\n";
+        return 0;
+    }
+    if (algorithms.empty()) {
+        algorithms = {
+            ZBufferAlgorithm::SimpleZBuffer,
+            ZBufferAlgorithm::ScanlineZBuffer,
+            ZBufferAlgorithm::HierarchicalZBuffer,
+            ZBufferAlgorithm::OctreeZBuffer,
+            ZBufferAlgorithm::OctreeZBufferFixed,
+        };
+    }
+    if (grids.empty()) {
+        grids = { { 1, 1 }, { 3, 3 }, { 5, 3 } };
+    }
+
+    TriangleMesh mesh{ model, reorder, lod };
+    auto colors = shadeTriangles(mesh, float3(1.0, 1.0, -1.0).normalized());
+    std::cerr << "Triangles: " << mesh.indices.size() << std::endl;
+
+    std::vector<Result> results;
+    for (auto algorithm : algorithms)
+    for (auto grid : grids)
+    for (auto proj_mode : { ProjectionMode::Perspective, ProjectionMode::Orthogonal })
+    for (auto path : { CameraPath::Static, CameraPath::Orbit, CameraPath::Tumble, CameraPath::Dolly }) {
+        // Octrees cached from the first frame would be stale on a moving camera.
+        if (algorithm == ZBufferAlgorithm::OctreeZBufferFixed && path != CameraPath::Static) continue;
+        Config config = { algorithm, { grid.first, grid.second }, proj_mode, path, precision, cull_meshlets, reorder, two_phase, occluder_pass, share_transform, lod, samples, depth_format, pyramid_format };
+        results.push_back(run(config, mesh, colors, frame_count));
+
+        auto const& r = results.back();
+        std::cerr << algorithmName(algorithm) << ' ' << grid.first << 'x' << grid.first << 'x' << grid.second
+                  << ' ' << projectionName(proj_mode) << ' ' << pathName(path)
+                  << ": " << r.mean << "ms" << std::endl;
+    }
+
+    std::stringstream ss;
+    bool json = output.size() >= 5 && output.compare(output.size() - 5, 5, ".json") == 0;
+    if (json) writeJSON(ss, results);
+    else writeCSV(ss, results);
+
+    if (output.empty()) {
+        std::cout << ss.str();
+        return 0;
+    }
+    std::ofstream file(output);
+    if (!file.is_open()) {
+        std::cout << "Failed to open file: " << output << std::endl;
+        return 1;
+    }
+    file << ss.str();
+    return 0;
+}
@@ -3,6 +3,8 @@
 #include <string>
 #include <iostream>
 #include <cstring>
+#include "frame_writer.h"
+#include "buffer.h"
 
 enum struct DrawMode {
     Single,
@@ -28,6 +30,21 @@ enum struct ProjectionMode {
     Orthogonal,
 };
 
+enum struct ShadingMode {
+    Forward,
+    Deferred,
+};
+
+enum struct RasterPrecision {
+    Pixel,
+    Subpixel,
+};
+
+enum struct FramebufferFormat {
+    RGB8,
+    RGBA8,
+};
+
 struct Arguments {
     std::string model;
     ZBufferAlgorithm algorithm = ZBufferAlgorithm::SimpleZBuffer;
@@ -35,19 +52,36 @@ struct Arguments {
     RenderMode render_mode = RenderMode::RealTime;
     int render_count = 0;
     ProjectionMode proj_mode = ProjectionMode::Perspective;
+    ShadingMode shading_mode = ShadingMode::Forward;
+    FramebufferFormat framebuffer_format = FramebufferFormat::RGB8;
+    RasterPrecision raster_precision = RasterPrecision::Pixel;
+    bool cull_meshlets = true;
+    bool reorder = true;
+    bool two_phase = false;
+    bool occluder_pass = false;
+    bool lod = false;
+    int samples = 1;
+    DepthFormat depth_precision = DepthFormat::Float32;
+    DepthFormat pyramid_precision = DepthFormat::Float32;
+    std::string visibility_path;
+    std::string frame_prefix;
+    ColorFileFormat frame_format = ColorFileFormat::PNG;
+    std::string depth_prefix;
+    DepthFileFormat depth_format = DepthFileFormat::PFM;
+    std::string overdraw_prefix;
 };
 
-void printHelp() {
+inline void printHelp() {
     std::cout << "-- Z-Buffer Help Info ---------------------------\n";
     std::cout << "Options:\n";
-    std::cout << " -i              Model to load, .obj format.\n";
+    std::cout << " -i              Model to load, .obj format, or scene to load, .scene format.\n";
     std::cout << " -z              Z-Buffer algorithm, the following options available:\n";
     std::cout << "     simple      Simple Z-Buffer;\n";
     std::cout << "     scanline    Scanline Z-Buffer;\n";
     std::cout << "     hiez        Hierarchical Z-Buffer;\n";
     std::cout << "     octz        Hierarchical Z-Buffer with Octree Acceleration;\n";
     std::cout << "     octzf       Hierarchical Z-Buffer with Octree Acceleration (static octree);\n";
-    std::cout << " -c              Model render count, the following options available:\n";
+    std::cout << " -c              Model render count, ignored for scenes, the following options available:\n";
     std::cout << "     1 n         Render 1 * 1 * n models;\n";
     std::cout << "     3 n         Render 3 * 3 * n models;\n";
     std::cout << "     5 n         Render 5 * 5 * n models;\n";
@@ -57,9 +91,50 @@ void printHelp() {
     std::cout << " -p              Projection model, the following options available:\n";
     std::cout << "     p           Perspective mode;\n";
     std::cout << "     o           Orthogonal mode;\n";
+    std::cout << " -s              Shading mode, the following options available:\n";
+    std::cout << "     f           Forward mode, shade on every depth test pass;\n";
+    std::cout << "     d           Deferred mode, depth prepass and shade each pixel once;\n";
+    std::cout << " -f              Framebuffer format, the following options available:\n";
+    std::cout << "     rgb         3 channels, tightly packed rows;\n";
+    std::cout << "     rgba        4 channels, 64-byte aligned rows;\n";
+    std::cout << " -r              Rasterization precision, the following options available:\n";
+    std::cout << "     pixel       Snap vertices to pixels;\n";
+    std::cout << "     subpixel    24.8 fixed point with top-left fill rule, not for scanline;\n";
+    std::cout << " -l              Meshlet culling, the following options available:\n";
+    std::cout << "     on          Cull meshlets by frustum, normal cone and depth pyramid;\n";
+    std::cout << "     off         Process every triangle;\n";
+    std::cout << " -k              Vertex cache reordering on load, the following options available:\n";
+    std::cout << "     on          Reorder triangles and vertices for vertex reuse;\n";
+    std::cout << "     off         Only sort triangles in Morton order, keep the file vertex order;\n";
+    std::cout << " -t              Two-phase occlusion culling (hiez, octz, octzf), the following options available:\n";
+    std::cout << "     on          Draw instances visible in the last frame first, cull the others against them;\n";
+    std::cout << "     off         Draw every instance;\n";
+    std::cout << " -x              Occluder pass, the following options available:\n";
+    std::cout << "     on          Draw the largest instances at low resolution first, cull instances behind them;\n";
+    std::cout << "     off         No occluder pass;\n";
+    std::cout << " -e              Levels of detail, the following options available:\n";
+    std::cout << "     on          Simplify meshes on load, cached in <model>.lod, draw by size on screen;\n";
+    std::cout << "     off         Draw full detail meshes;\n";
+    std::cout << " -a              Multi-sample anti-aliasing (simple), the following options available:\n";
+    std::cout << "     1           One sample per pixel;\n";
+    std::cout << "     4           4 samples per pixel, depth compressed per tile;\n";
+    std::cout << "     8           8 samples per pixel, depth compressed per tile;\n";
+    std::cout << " -q              Depth storage, base level then pyramid (simple, hiez, octz, octzf):\n";
+    std::cout << "     f32 | u24 | u16  Base level in 32-bit floats or unorm 24 or 16 bits;\n";
+    std::cout << "     f32 | u16 | u8   Pyramid in 32-bit floats or unorm 16 or 8 bits, rounded conservatively;\n";
+    std::cout << " -v              Dump (instance, triangle) id of each pixel of the last frame to the given file.\n";
+    std::cout << " -w              Write every frame in background to <prefix><frame>.<format>:\n";
+    std::cout << "     prefix png  PNG with fast compression;\n";
+    std::cout << "     prefix ppm  Uncompressed PPM;\n";
+    std::cout << " -d              Write depth of every frame in background to <prefix><frame>.<format>:\n";
+    std::cout << "     prefix png8  8-bit PNG;\n";
+    std::cout << "     prefix png16 16-bit PNG;\n";
+    std::cout << "     prefix pfm   32-bit float PFM;\n";
+    std::cout << " -o              Count depth tests and writes per pixel, write heatmaps of the last frame\n";
+    std::cout << "                 to <prefix>_tests.png and <prefix>_writes.png and print overdraw ratios.\n";
 }
 
-bool parse(int argc, char* argv[], Arguments * args) {
+inline bool parse(int argc, char* argv[], Arguments * args) {
     if (argc < 2) {
         printHelp();
         return false;
@@ -124,6 +199,149 @@ bool parse(int argc, char* argv[], Arguments * args) {
                 i += 1;
             }
         }
+        else if (std::strcmp(argv[i], "-f") == 0 && (i < argc - 1)) {
+            i += 1;
+            if (std::strcmp(argv[i], "rgb") == 0 && (i < argc)) {
+                args->framebuffer_format = FramebufferFormat::RGB8;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "rgba") == 0 && (i < argc)) {
+                args->framebuffer_format = FramebufferFormat::RGBA8;
+                i += 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "-r") == 0 && (i < argc - 1)) {
+            i += 1;
+            if (std::strcmp(argv[i], "pixel") == 0 && (i < argc)) {
+                args->raster_precision = RasterPrecision::Pixel;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "subpixel") == 0 && (i < argc)) {
+                args->raster_precision = RasterPrecision::Subpixel;
+                i += 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "-l") == 0 && (i < argc - 1)) {
+            i += 1;
+            if (std::strcmp(argv[i], "on") == 0 && (i < argc)) {
+                args->cull_meshlets = true;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "off") == 0 && (i < argc)) {
+                args->cull_meshlets = false;
+                i += 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "-k") == 0 && (i < argc - 1)) {
+            i += 1;
+            if (std::strcmp(argv[i], "on") == 0 && (i < argc)) {
+                args->reorder = true;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "off") == 0 && (i < argc)) {
+                args->reorder = false;
+                i += 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "-t") == 0 && (i < argc - 1)) {
+            i += 1;
+            if (std::strcmp(argv[i], "on") == 0 && (i < argc)) {
+                args->two_phase = true;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "off") == 0 && (i < argc)) {
+                args->two_phase = false;
+                i += 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "-x") == 0 && (i < argc - 1)) {
+            i += 1;
+            if (std::strcmp(argv[i], "on") == 0 && (i < argc)) {
+                args->occluder_pass = true;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "off") == 0 && (i < argc)) {
+                args->occluder_pass = false;
+                i += 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "-e") == 0 && (i < argc - 1)) {
+            i += 1;
+            if (std::strcmp(argv[i], "on") == 0 && (i < argc)) {
+                args->lod = true;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "off") == 0 && (i < argc)) {
+                args->lod = false;
+                i += 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "-a") == 0 && (i < argc - 1)) {
+            i += 1;
+            if (std::strcmp(argv[i], "1") == 0 || std::strcmp(argv[i], "4") == 0
+             || std::strcmp(argv[i], "8") == 0) {
+                args->samples = atoi(argv[i]);
+                i += 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "-q") == 0 && (i < argc - 2)) {
+            i += 1;
+            if (std::strcmp(argv[i], "f32") == 0) args->depth_precision = DepthFormat::Float32;
+            else if (std::strcmp(argv[i], "u24") == 0) args->depth_precision = DepthFormat::Unorm24;
+            else if (std::strcmp(argv[i], "u16") == 0) args->depth_precision = DepthFormat::Unorm16;
+            i += 1;
+            if (std::strcmp(argv[i], "f32") == 0) args->pyramid_precision = DepthFormat::Float32;
+            else if (std::strcmp(argv[i], "u16") == 0) args->pyramid_precision = DepthFormat::Unorm16;
+            else if (std::strcmp(argv[i], "u8") == 0) args->pyramid_precision = DepthFormat::Unorm8;
+            i += 1;
+        }
+        else if (std::strcmp(argv[i], "-v") == 0 && (i < argc - 1)) {
+            args->visibility_path = std::string(argv[i + 1]);
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-w") == 0 && (i < argc - 2)) {
+            args->frame_prefix = std::string(argv[i + 1]);
+            i += 2;
+            if (std::strcmp(argv[i], "png") == 0) {
+                args->frame_format = ColorFileFormat::PNG;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "ppm") == 0) {
+                args->frame_format = ColorFileFormat::PPM;
+                i += 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "-d") == 0 && (i < argc - 2)) {
+            args->depth_prefix = std::string(argv[i + 1]);
+            i += 2;
+            if (std::strcmp(argv[i], "png8") == 0) {
+                args->depth_format = DepthFileFormat::PNG8;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "png16") == 0) {
+                args->depth_format = DepthFileFormat::PNG16;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "pfm") == 0) {
+                args->depth_format = DepthFileFormat::PFM;
+                i += 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "-o") == 0 && (i < argc - 1)) {
+            args->overdraw_prefix = std::string(argv[i + 1]);
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-s") == 0 && (i < argc - 1)) {
+            i += 1;
+            if (std::strcmp(argv[i], "f") == 0 && (i < argc)) {
+                args->shading_mode = ShadingMode::Forward;
+                i += 1;
+            }
+            else if (std::strcmp(argv[i], "d") == 0 && (i < argc)) {
+                args->shading_mode = ShadingMode::Deferred;
+                i += 1;
+            }
+        }
         else {
             i += 1;
         }
@@ -3,11 +3,248 @@
 #include <cassert>
 #include <vector>
 #include <iostream>
+#include <cstdio>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include "vector.h"
+#include "matrix.h"
+#include "image.h"
+#include "utils.h"
+
+// Number of occlusion queries tested side by side, one bit of a result word each.
+#define OCCLUSION_QUERY_BATCH 32
+
+// Depths per fast clear block, consecutive in memory.
+#define DEPTH_CLEAR_BLOCK 64
+
+/**
+ * Boxes to test against a HierarchicalZBuffer in one batch, stored as one
+ * array per bound so that a batch of queries is processed side by side.
+ * How to use:
+ *  1. Add pixel rectangles with their nearest depth, or boxes in model
+ *     space with their transform. Queries are indexed in the order added:
+ *      ```
+ *      OcclusionQueries queries(width, height);
+ *      queries.add(x_min, x_max, y_min, y_max, z_min);
+ *      queries.add(box_min, box_max, mvp);
+ *      ```
+ *  2. Test all of them against the depth pyramid and read the results:
+ *      ```
+ *      depth.query(queries);
+ *      if (queries.visible(i)) ...
+ *      ```
+ * Results are conservative, a query is only reported hidden if it is behind
+ * the pyramid or entirely out of the view volume.
+ */
+struct OcclusionQueries {
+    int width;
+    int height;
+    std::vector<int> x_min;
+    std::vector<int> x_max;
+    std::vector<int> y_min;
+    std::vector<int> y_max;
+    std::vector<float> z;
+    // Bit i % OCCLUSION_QUERY_BATCH of word i / OCCLUSION_QUERY_BATCH is
+    // set if query i may be visible.
+    std::vector<unsigned int> bits;
+
+    OcclusionQueries(int w, int h)
+        : width(w)
+        , height(h) {}
+
+    int size() const { return x_min.size(); }
+
+    void clear() {
+        x_min.clear();
+        x_max.clear();
+        y_min.clear();
+        y_max.clear();
+        z.clear();
+        bits.clear();
+    }
+
+    bool visible(int i) const {
+        assert(i >= 0 && i < size());
+        return (bits[i / OCCLUSION_QUERY_BATCH] >> (i % OCCLUSION_QUERY_BATCH)) & 1;
+    }
+
+    // Pixel rectangle, clamped to the screen, and its nearest NDC depth.
+    void add(int x0, int x1, int y0, int y1, float z_min) {
+        x_min.push_back(clamp(x0, 0, width - 1));
+        x_max.push_back(clamp(x1, 0, width - 1));
+        y_min.push_back(clamp(y0, 0, height - 1));
+        y_max.push_back(clamp(y1, 0, height - 1));
+        z.push_back(z_min);
+    }
+
+    // Axis-aligned box in model space, projected by mvp.
+    void add(float3 const& box_min, float3 const& box_max, float4x4 const& mvp) {
+        auto min = float3(std::numeric_limits<float>::max());
+        auto max = float3(std::numeric_limits<float>::lowest());
+        for (int i = 0; i < 8; ++i) {
+            auto corner = float3(i & 1 ? box_max.x : box_min.x,
+                                 i & 2 ? box_max.y : box_min.y,
+                                 i & 4 ? box_max.z : box_min.z);
+            auto v = mvp * float4(corner, 1.0f);
+            // Crossing the near plane, the projected bound is unknown.
+            if (v.w <= 0 || v.z < 0) {
+                add(0, width - 1, 0, height - 1, std::numeric_limits<float>::lowest());
+                return;
+            }
+            auto ndc = float3(v) / v.w;
+            min = float3::min(min, ndc);
+            max = float3::max(max, ndc);
+        }
+
+        // Out of the view volume, nothing can pass a depth test against it.
+        if (max.x < -1 || min.x > 1 || max.y < -1 || min.y > 1 || min.z > 1) {
+            add(0, 0, 0, 0, std::numeric_limits<float>::infinity());
+            return;
+        }
+        add((int)std::floor((min.x * 0.5f + 0.5f) * width),
+            (int)std::floor((max.x * 0.5f + 0.5f) * width),
+            (int)std::floor((min.y * 0.5f + 0.5f) * height),
+            (int)std::floor((max.y * 0.5f + 0.5f) * height),
+            min.z);
+    }
+};
+
+// Storage of depth, unorm formats map [0, 1] to integers in [0, 2^bits - 1].
+// Rasterizers drop samples of negative NDC depth, so no depth stored is negative.
+enum struct DepthFormat {
+    Float32,
+    Unorm24,
+    Unorm16,
+    Unorm8,
+};
+
+/**
+ * One level of depth in a given format, unorm depths are packed in 1 to 3
+ * bytes each.
+ * Values written are rounded to the format:
+ * - set() and nearest() round to the nearest value, for depth tested per pixel.
+ * - setFar() and farthest() round to a value not nearer than z, for the
+ *   farthest depth of a block, so that occlusion tests against it stay
+ *   conservative.
+ * fill() only flags every block of DEPTH_CLEAR_BLOCK depths as cleared,
+ * reads of a cleared block return the clear value and the first write to
+ * it stores the clear value in the whole block.
+ */
+struct DepthLevel {
+    DepthFormat format = DepthFormat::Float32;
+    int size = 0;
+    int bytes = 4; // per depth
+    std::vector<float> values; // Float32
+    std::vector<unsigned char> codes; // unorm formats, little-endian
+    std::vector<unsigned char> cleared; // per block
+    float clear_value = 0.0f;
+
+    void init(int n, DepthFormat f) {
+        format = f;
+        size = n;
+        switch (f) {
+        case DepthFormat::Float32: bytes = 4; break;
+        case DepthFormat::Unorm24: bytes = 3; break;
+        case DepthFormat::Unorm16: bytes = 2; break;
+        case DepthFormat::Unorm8:  bytes = 1; break;
+        }
+        bool unorm = f != DepthFormat::Float32;
+        values.assign(unorm ? 0 : n, 0.0f);
+        codes.assign(unorm ? (size_t)n * bytes : 0, 0);
+        cleared.assign((n + DEPTH_CLEAR_BLOCK - 1) / DEPTH_CLEAR_BLOCK, 0);
+        max_code = unorm ? (1u << (bytes * 8)) - 1 : 0;
+        scale = unorm ? 1.0 / max_code : 0.0;
+    }
+
+    float at(int i) const {
+        assert(i >= 0 && i < size);
+        if (cleared[i / DEPTH_CLEAR_BLOCK]) return clear_value;
+        if (format == DepthFormat::Float32) return values[i];
+        auto p = &codes[(size_t)i * bytes];
+        unsigned int c = p[0];
+        if (bytes > 1) c |= p[1] << 8;
+        if (bytes > 2) c |= p[2] << 16;
+        return decode(c);
+    }
+
+    void set(int i, float z) {
+        touch(i);
+        if (format == DepthFormat::Float32) values[i] = z;
+        else setCode(i, encode(z));
+    }
+
+    void setFar(int i, float z) {
+        touch(i);
+        if (format == DepthFormat::Float32) values[i] = z;
+        else setCode(i, encodeFar(z));
+    }
+
+    float nearest(float z) const {
+        return format == DepthFormat::Float32 ? z : decode(encode(z));
+    }
+
+    float farthest(float z) const {
+        return format == DepthFormat::Float32 ? z : decode(encodeFar(z));
+    }
+
+    // Clears to z, which must be a value of the format.
+    void fill(float z) {
+        clear_value = z;
+        std::fill(cleared.begin(), cleared.end(), 1);
+    }
+
+    // Stores the clear value in the block of depth i if it is still cleared,
+    // before values or codes are accessed directly.
+    void touch(int i) {
+        assert(i >= 0 && i < size);
+        auto block = i / DEPTH_CLEAR_BLOCK;
+        if (!cleared[block]) return;
+        cleared[block] = 0;
+        auto first = block * DEPTH_CLEAR_BLOCK;
+        auto last = std::min(first + DEPTH_CLEAR_BLOCK, size);
+        if (format == DepthFormat::Float32) {
+            std::fill(values.begin() + first, values.begin() + last, clear_value);
+            return;
+        }
+        auto c = encode(clear_value);
+        for (int j = first; j < last; ++j) setCode(j, c);
+    }
+
+private:
+    unsigned int max_code = 0;
+    double scale = 0.0; // depth per code
+
+    void setCode(int i, unsigned int c) {
+        assert(i >= 0 && i < size);
+        auto p = &codes[(size_t)i * bytes];
+        for (int k = 0; k < bytes; ++k) p[k] = (c >> (k * 8)) & 0xff;
+    }
+
+    float decode(unsigned int c) const {
+        return (float)(c * scale);
+    }
+
+    unsigned int encode(float z) const {
+        auto d = clamp((double)z, 0.0, 1.0);
+        return (unsigned int)(d * max_code + 0.5);
+    }
+
+    unsigned int encodeFar(float z) const {
+        auto d = clamp((double)z, 0.0, 1.0) * max_code;
+        auto c = (unsigned int)d;
+        if (c < d) ++c;
+        // Decoding rounds to float, which may land just before z.
+        if (c < max_code && decode(c) < z) ++c;
+        return c;
+    }
+};
 
 struct HierarchicalZBuffer {
 
-    std::vector<float*> mip;
+    std::vector<DepthLevel> mip;
     std::vector<std::vector<int2>> mip_childern;
     int width;
     int height;
@@ -16,7 +253,8 @@ struct HierarchicalZBuffer {
 
     int maxLevel() const { return mip.size() - 1; }
 
-    HierarchicalZBuffer(int w, int h)
+    HierarchicalZBuffer(int w, int h, DepthFormat base = DepthFormat::Float32,
+                        DepthFormat pyramid = DepthFormat::Float32)
         : width(w)
         , height(h) {
         
@@ -29,8 +267,6 @@ struct HierarchicalZBuffer {
         while (w > 0 && h > 0) {
             mip_w.push_back(w);
             mip_h.push_back(h);
-            float* buffer = new float[w * h];
-            mip.push_back(buffer);
 
             std::vector<int2> childern(w * h);
             if (level > 0) {
@@ -47,15 +283,24 @@ struct HierarchicalZBuffer {
             h /= 2;
             ++level;
         }
+        mip.resize(level);
+        setFormat(base, pyramid);
     }
-    ~HierarchicalZBuffer() {
-        for (int i = 0; i < mip.size(); ++i) {
-            delete[] mip[i];
+
+    /**
+     * Format of the base level, tested per pixel, and of the upper levels,
+     * which only hold conservative farthest depths. Clears to depth 1.
+     */
+    void setFormat(DepthFormat base, DepthFormat pyramid) {
+        for (int i = 0; i < (int)mip.size(); ++i) {
+            mip[i].init(mip_w[i] * mip_h[i], i == 0 ? base : pyramid);
         }
+        float_only = base == DepthFormat::Float32 && pyramid == DepthFormat::Float32;
+        clear(1.0f);
     }
 
     float at(int x, int y, int level) const {
-        assert(level >= 0 && level < mip.size());
+        assert(level >= 0 && level < (int)mip.size());
         assert(x >= 0 && x < width);
         assert(y >= 0 && y < height);
 
@@ -64,15 +309,100 @@ struct HierarchicalZBuffer {
 
         int offset = y * mip_w[level] + x;
 
-        return mip[level][offset];
+        return mip[level].at(offset);
     }
 
-    void clear(float z) {
-        for (int i = 0; i < mip.size(); ++i) {
-            int size = mip_w[i] * mip_h[i];
-            for (int j = 0; j < size; ++j) {
-                mip[i][j] = z;
+    // Finest level whose blocks are larger than the given pixel extents, so
+    // that a rectangle of that size overlaps at most 2x2 of its blocks.
+    int startLevel(int x_extent, int y_extent) const {
+        int level = 0;
+        while (level < maxLevel()
+            && (width / mip_w[level] <= x_extent || height / mip_h[level] <= y_extent)) {
+            ++level;
+        }
+        return level;
+    }
+
+    /**
+     * Returns true if everything in the given pixel rectangle at depth z or
+     * farther is hidden. Tests at most 2x2 blocks of the startLevel() of
+     * the rectangle.
+     */
+    bool occluded(int x_min, int x_max, int y_min, int y_max, float z) const {
+        int level = startLevel(x_max - x_min, y_max - y_min);
+        auto w = width / mip_w[level];
+        auto h = height / mip_h[level];
+        for (int y = y_min & ~(h - 1); y <= y_max; y += h) {
+            for (int x = x_min & ~(w - 1); x <= x_max; x += w) {
+                if (z <= at(x, y, level)) return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Tests every query, with the same result as occluded() for each.
+     * Queries are processed OCCLUSION_QUERY_BATCH at a time, choosing levels
+     * and comparing depths without branches so that the compiler can
+     * vectorize across queries. Only sampling the pyramid is done one by one.
+     */
+    void query(OcclusionQueries & queries) const {
+        int const count = queries.size();
+        queries.bits.assign((count + OCCLUSION_QUERY_BATCH - 1) / OCCLUSION_QUERY_BATCH, 0);
+        int const top = maxLevel();
+
+        int level[OCCLUSION_QUERY_BATCH];
+        float far[OCCLUSION_QUERY_BATCH];
+        for (int first = 0; first < count; first += OCCLUSION_QUERY_BATCH) {
+            int const n = std::min(OCCLUSION_QUERY_BATCH, count - first);
+            int const* x_min = &queries.x_min[first];
+            int const* x_max = &queries.x_max[first];
+            int const* y_min = &queries.y_min[first];
+            int const* y_max = &queries.y_max[first];
+            float const* z = &queries.z[first];
+
+            // Finest level whose blocks are larger than the rectangle, which
+            // then overlaps at most 2x2 blocks, its corners are enough.
+            for (int i = 0; i < n; ++i) {
+                auto span = std::max(x_max[i] - x_min[i], y_max[i] - y_min[i]);
+                int l = 0;
+                for (int k = 0; k < top; ++k) l += (span >> k) != 0;
+                level[i] = l;
+            }
+
+            for (int i = 0; i < n; ++i) {
+                auto l = level[i];
+                auto row = mip_w[l];
+                auto const& buffer = mip[l];
+                auto x0 = x_min[i] >> l;
+                auto x1 = x_max[i] >> l;
+                auto y0 = (y_min[i] >> l) * row;
+                auto y1 = (y_max[i] >> l) * row;
+                far[i] = std::max(std::max(buffer.at(y0 + x0), buffer.at(y0 + x1)),
+                                  std::max(buffer.at(y1 + x0), buffer.at(y1 + x1)));
             }
+
+            unsigned int word = 0;
+            for (int i = 0; i < n; ++i) {
+                word |= (unsigned int)(z[i] <= far[i]) << i;
+            }
+
+            // Rectangles larger than the blocks of the coarsest level, which
+            // may overlap more blocks than their corners.
+            for (int i = 0; i < n; ++i) {
+                auto span = std::max(x_max[i] - x_min[i], y_max[i] - y_min[i]);
+                if ((span >> top) == 0) continue;
+                if (!occluded(x_min[i], x_max[i], y_min[i], y_max[i], z[i])) word |= 1u << i;
+                else word &= ~(1u << i);
+            }
+            queries.bits[first / OCCLUSION_QUERY_BATCH] = word;
+        }
+    }
+
+    void clear(float z) {
+        mip[0].fill(mip[0].nearest(z));
+        for (int i = 1; i < (int)mip.size(); ++i) {
+            mip[i].fill(mip[i].farthest(z));
         }
     }
 
@@ -81,91 +411,325 @@ struct HierarchicalZBuffer {
         assert(y >= 0 && y < height);
 
         int offset = y * mip_w[0] + x;
-        mip[0][offset] = z;
+        mip[0].set(offset, z);
     }
 
     void write(int x, int y, float z) {
         assert(x >= 0 && x < width);
         assert(y >= 0 && y < height);
 
+        if (float_only) {
+            writeFloat(x, y, z);
+            return;
+        }
+
         int offset = y * mip_w[0] + x;
-        mip[0][offset] = z;
+        // Upper levels bound the depth as stored.
+        z = mip[0].nearest(z);
+        mip[0].set(offset, z);
 
-        for (int i = 1; i < mip.size(); ++i) {
+        for (int i = 1; i < (int)mip.size(); ++i) {
             x /= 2;
             y /= 2;
 
             offset = y * mip_w[i] + x;
-            if (z > mip[i][offset]) {
-                mip[i][offset] = z;
+            auto far = mip[i].farthest(z);
+            if (far > mip[i].at(offset)) {
+                mip[i].setFar(offset, z);
                 continue;
             }
-            auto prev = i - 1;
-            auto max_z = std::max(std::max(mip[prev][mip_childern[i][offset][0] + 0],
-                                           mip[prev][mip_childern[i][offset][0] + 1]),
-                                  std::max(mip[prev][mip_childern[i][offset][1] + 0],
-                                           mip[prev][mip_childern[i][offset][1] + 1]));
-            if (max_z == mip[i][offset]) break;
-            mip[i][offset] = max_z;
+            far = mip[i].farthest(childrenMax(i, offset));
+            if (far == mip[i].at(offset)) break;
+            mip[i].set(offset, far);
         }
     }
 
     // Too slow, even per mesh is unacceptable.
     void update() {
-        for (int i = 1; i < mip.size(); ++i) {
+        for (int i = 1; i < (int)mip.size(); ++i) {
             for (int x = 0; x < mip_w[i]; ++x) for (int y = 0; y < mip_h[i]; ++y) {
-                auto prev = i - 1;
                 auto offset = y * mip_w[i] + x;
-                auto max_z = std::max(std::max(mip[prev][mip_childern[i][offset][0] + 0],
-                                               mip[prev][mip_childern[i][offset][0] + 1]),
-                                      std::max(mip[prev][mip_childern[i][offset][1] + 0],
-                                               mip[prev][mip_childern[i][offset][1] + 1]));
+                mip[i].setFar(offset, childrenMax(i, offset));
+            }
+        }
+    }
 
-                mip[i][offset] = max_z;
+private:
+    // Every level stores floats, which need no rounding.
+    bool float_only = true;
+
+    void writeFloat(int x, int y, float z) {
+        int offset = y * mip_w[0] + x;
+        mip[0].touch(offset);
+        mip[0].values[offset] = z;
+
+        for (int i = 1; i < (int)mip.size(); ++i) {
+            x /= 2;
+            y /= 2;
+
+            offset = y * mip_w[i] + x;
+            mip[i].touch(offset);
+            auto & values = mip[i].values;
+            if (z > values[offset]) {
+                values[offset] = z;
+                continue;
             }
+            auto const& c = mip_childern[i][offset];
+            // Blocks have an even size, so each pair of children is in one.
+            mip[i - 1].touch(c[0]);
+            mip[i - 1].touch(c[1]);
+            auto const& prev = mip[i - 1].values;
+            auto max_z = std::max(std::max(prev[c[0] + 0], prev[c[0] + 1]),
+                                  std::max(prev[c[1] + 0], prev[c[1] + 1]));
+            if (max_z == values[offset]) break;
+            values[offset] = max_z;
         }
     }
 
+    // Farthest depth of the 2x2 blocks of level i - 1 under a block of level i.
+    float childrenMax(int i, int offset) const {
+        auto const& prev = mip[i - 1];
+        auto const& c = mip_childern[i][offset];
+        return std::max(std::max(prev.at(c[0] + 0), prev.at(c[0] + 1)),
+                        std::max(prev.at(c[1] + 0), prev.at(c[1] + 1)));
+    }
+
 };
 
 
 struct ZBuffer {
 
-    float* buffer;
+    DepthLevel level;
     int width;
     int height;
 
-    ZBuffer(int w, int h)
+    ZBuffer(int w, int h, DepthFormat format = DepthFormat::Float32)
         : width(w)
         , height(h) {
 
-        buffer = new float[width * height];
+        setFormat(format);
     }
-    ~ZBuffer() {
-        delete[] buffer;
+
+    void setFormat(DepthFormat format) {
+        level.init(width * height, format);
+        clear(1.0f);
     }
 
     float at(int x, int y) const {
         assert(x >= 0 && x < width);
         assert(y >= 0 && y < height);
-        int offset = y * width + x;
-        assert(offset < width * height);
-        return buffer[offset];
+        return level.at(y * width + x);
     }
 
     void clear(float z) {
+        level.fill(level.nearest(z));
+    }
+
+    void write(int x, int y, float z) {
+        assert(x >= 0 && x < width);
+        assert(y >= 0 && y < height);
+        level.set(y * width + x, z);
+    }
+
+};
+
+
+
+// Number of low bits of a visibility id holding the triangle index,
+// the remaining high bits hold the instance index.
+#define VISIBILITY_TRIANGLE_BITS 32
+
+// (instance, triangle) id of a pixel.
+using visibility_id = unsigned long long;
+
+/**
+ * Per-pixel (instance, triangle) id packed into 64 bits.
+ * - Holds any 32-bit instance index and triangle indices below
+ *   max_triangles, the id with all bits set is left for empty.
+ * - Written by the depth prepass, after all meshes are drawn resolve()
+ *   shades each covered pixel exactly once.
+ * - Can also be dumped as a render target by writeBinary().
+ */
+struct VisibilityBuffer {
+
+    static constexpr visibility_id empty = ~0ull;
+    static constexpr visibility_id triangle_mask = (1ull << VISIBILITY_TRIANGLE_BITS) - 1;
+    static constexpr unsigned long long max_triangles = triangle_mask;
+
+    static visibility_id encode(unsigned int instance, unsigned int triangle) {
+        assert(triangle < max_triangles);
+        return ((visibility_id)instance << VISIBILITY_TRIANGLE_BITS) | triangle;
+    }
+    static unsigned int instanceOf(visibility_id id) { return (unsigned int)(id >> VISIBILITY_TRIANGLE_BITS); }
+    static unsigned int triangleOf(visibility_id id) { return (unsigned int)(id & triangle_mask); }
+
+    visibility_id* buffer;
+    int width;
+    int height;
+
+    VisibilityBuffer(int w, int h)
+        : width(w)
+        , height(h) {
+
+        buffer = new visibility_id[width * height];
+    }
+    ~VisibilityBuffer() {
+        delete[] buffer;
+    }
+
+    visibility_id at(int x, int y) const {
+        assert(x >= 0 && x < width);
+        assert(y >= 0 && y < height);
+        return buffer[y * width + x];
+    }
+
+    void clear() {
         int size = width * height;
         for (int i = 0; i < size; ++i) {
-            buffer[i] = z;
+            buffer[i] = empty;
         }
     }
 
-    void write(int x, int y, float z) {
+    void write(int x, int y, visibility_id id) {
+        assert(x >= 0 && x < width);
+        assert(y >= 0 && y < height);
+        buffer[y * width + x] = id;
+    }
+
+    // Triangle colors of the mesh of each instance.
+    void resolve(std::vector<std::vector<color8> const*> const& instance_colors, Image & image) const {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                auto id = buffer[y * width + x];
+                if (id == empty) continue;
+                image.writePixel(x, y, (*instance_colors[instanceOf(id)])[triangleOf(id)]);
+            }
+        }
+    }
+
+    /**
+     * Dump the buffer as a binary file:
+     *  - char[4]   "ZBVB"
+     *  - uint32    width, height, VISIBILITY_TRIANGLE_BITS
+     *  - uint64[]  width * height ids, rows from bottom to top, the
+     *              instance in the high VISIBILITY_TRIANGLE_BITS bits and
+     *              the triangle in the low bits, 0xffffffffffffffff for
+     *              pixels not covered.
+     */
+    void writeBinary(std::string const& path) const {
+        FILE *fp;
+        fp = fopen(path.c_str(), "wb");
+        if (fp == nullptr) {
+            std::cout << "Failed to open file: " << path << std::endl;
+            return;
+        }
+        unsigned int header[3] = { (unsigned int)width, (unsigned int)height, VISIBILITY_TRIANGLE_BITS };
+        fwrite("ZBVB", 1, 4, fp);
+        fwrite(header, sizeof(unsigned int), 3, fp);
+        fwrite(buffer, sizeof(visibility_id), width * height, fp);
+        fclose(fp);
+    }
+
+};
+
+
+/**
+ * Per-pixel count of depth tests and depth writes, used to find overdraw.
+ * - Rasterizers count into it when overdraw counting is enabled.
+ * - writes / covered pixels is the overdraw ratio, 1 when every pixel
+ *   is written once.
+ */
+struct OverdrawBuffer {
+
+    unsigned int* tests;
+    unsigned int* writes;
+    int width;
+    int height;
+
+    OverdrawBuffer(int w, int h)
+        : width(w)
+        , height(h) {
+
+        tests = new unsigned int[width * height];
+        writes = new unsigned int[width * height];
+    }
+    ~OverdrawBuffer() {
+        delete[] tests;
+        delete[] writes;
+    }
+
+    void clear() {
+        int size = width * height;
+        for (int i = 0; i < size; ++i) {
+            tests[i] = 0;
+            writes[i] = 0;
+        }
+    }
+
+    void test(int x, int y) {
         assert(x >= 0 && x < width);
         assert(y >= 0 && y < height);
-        int offset = y * width + x;
-        assert(offset < width * height);
-        buffer[offset] = z;
+        ++tests[y * width + x];
+    }
+
+    void write(int x, int y) {
+        assert(x >= 0 && x < width);
+        assert(y >= 0 && y < height);
+        ++writes[y * width + x];
+    }
+
+    // Pixels with at least one depth write.
+    long long coveredPixels() const {
+        long long count = 0;
+        for (int i = 0; i < width * height; ++i) count += writes[i] > 0;
+        return count;
+    }
+    long long totalTests() const {
+        long long count = 0;
+        for (int i = 0; i < width * height; ++i) count += tests[i];
+        return count;
+    }
+    long long totalWrites() const {
+        long long count = 0;
+        for (int i = 0; i < width * height; ++i) count += writes[i];
+        return count;
+    }
+
+    void report(std::ostream & out) const {
+        auto covered = coveredPixels();
+        auto ratio = [=](long long count) { return covered ? (double)count / covered : 0.0; };
+        out << "Overdraw: covered " << covered << " pixels"
+            << ", tests " << ratio(totalTests()) << " per pixel"
+            << ", writes " << ratio(totalWrites()) << " per pixel\n";
+    }
+
+    /**
+     * False-color heatmap of tests or writes, black for 0, then blue, green,
+     * yellow and red for max_count or more.
+     */
+    void writeHeatmap(std::string const& path, bool count_writes, unsigned int max_count = 16) const {
+        Image image(width, height);
+        auto counts = count_writes ? writes : tests;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                auto count = counts[y * width + x];
+                if (count == 0) continue;
+                auto t = clamp((float)(count - 1) / (max_count - 1), 0.0f, 1.0f);
+                image.writePixel(x, y, quantize(heatColor(t)));
+            }
+        }
+        image.writePNG(path);
+    }
+
+    static colorf heatColor(float t) {
+        // Piecewise linear ramp blue -> cyan -> green -> yellow -> red.
+        float3 const ramp[5] = {
+            float3(0, 0, 1), float3(0, 1, 1), float3(0, 1, 0), float3(1, 1, 0), float3(1, 0, 0),
+        };
+        auto s = t * 4;
+        auto i = std::min((int)s, 3);
+        auto f = s - i;
+        return colorf(ramp[i] * (1 - f) + ramp[i + 1] * f, 1.0f);
     }
 
 };
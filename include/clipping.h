@@ -0,0 +1,260 @@
+/**
+ * Vertex stage shared by all rasterizers: transform, frustum culling,
+ * near-plane clipping and guard-band clipping.
+ * How to use:
+ *  1. Keep one stage per rasterizer so that its buffers are reused:
+ *      ```
+ *      VertexStage stage;
+ *      ```
+ *  2. Process a mesh every draw, false if the whole mesh is culled,
+ *     optionally culling whole meshlets first:
+ *      ```
+ *      if (!stage.process(mesh, mvp, cull_meshlets)) return;
+ *      for (auto const& t : stage.triangles) {
+ *          auto v0 = stage.ndc[t.v[0]]; // NDC position
+ *          ...                          // t.id is mesh.sourceTriangle(triangle index)
+ *      }
+ *      ```
+ *  3. Instances that are translated copies of a mesh can share the transform
+ *     of its vertices, set before processing each of them:
+ *      ```
+ *      shared.update(mesh, mvp);                 // once per frame
+ *      stage.shared = &shared;
+ *      stage.shared_offset = shared.offset(t);
+ *      stage.process(mesh, mvp * translate(t.x, t.y, t.z));
+ *      ```
+ * Triangles are clipped in homogeneous space only when they cross the near
+ * plane or leave the guard band, which keeps screen coordinates bounded.
+ * Triangles inside the guard band are not clipped, the rasterizers scissor
+ * them to the screen with their clamped bounding box.
+ */
+
+#pragma once
+
+#include <vector>
+#include <limits>
+#include "vector.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "stats.h"
+#include "meshlet.h"
+
+// Guard band in NDC, triangles with x or y beyond it are clipped.
+#define CLIP_GUARD_BAND 2.0f
+// Rasterizers reject depth below 0, the near plane is moved slightly in
+// front of it so that the reciprocal of depth stays finite.
+#define CLIP_NEAR_Z 1e-6f
+
+enum ClipCode : unsigned int {
+    CLIP_LEFT         = 1 << 0,
+    CLIP_RIGHT        = 1 << 1,
+    CLIP_BOTTOM       = 1 << 2,
+    CLIP_TOP          = 1 << 3,
+    CLIP_NEAR         = 1 << 4,
+    CLIP_FAR          = 1 << 5,
+    CLIP_GUARD_LEFT   = 1 << 6,
+    CLIP_GUARD_RIGHT  = 1 << 7,
+    CLIP_GUARD_BOTTOM = 1 << 8,
+    CLIP_GUARD_TOP    = 1 << 9,
+
+    CLIP_FRUSTUM = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP | CLIP_NEAR | CLIP_FAR,
+    // Planes that need clipping when a triangle crosses them.
+    CLIP_PLANES = CLIP_NEAR | CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_BOTTOM | CLIP_GUARD_TOP,
+};
+
+inline unsigned int clipCode(float4 const& v) {
+    unsigned int code = 0;
+    if (v.x < -v.w) code |= CLIP_LEFT;
+    if (v.x >  v.w) code |= CLIP_RIGHT;
+    if (v.y < -v.w) code |= CLIP_BOTTOM;
+    if (v.y >  v.w) code |= CLIP_TOP;
+    if (v.z < CLIP_NEAR_Z * v.w) code |= CLIP_NEAR;
+    if (v.z >  v.w) code |= CLIP_FAR;
+    if (v.x < -CLIP_GUARD_BAND * v.w) code |= CLIP_GUARD_LEFT;
+    if (v.x >  CLIP_GUARD_BAND * v.w) code |= CLIP_GUARD_RIGHT;
+    if (v.y < -CLIP_GUARD_BAND * v.w) code |= CLIP_GUARD_BOTTOM;
+    if (v.y >  CLIP_GUARD_BAND * v.w) code |= CLIP_GUARD_TOP;
+    return code;
+}
+
+// Signed distance to a clip plane, inside when non-negative.
+inline float clipDistance(float4 const& v, unsigned int plane) {
+    switch (plane) {
+    case CLIP_NEAR:         return v.z - CLIP_NEAR_Z * v.w;
+    case CLIP_GUARD_LEFT:   return v.x + CLIP_GUARD_BAND * v.w;
+    case CLIP_GUARD_RIGHT:  return CLIP_GUARD_BAND * v.w - v.x;
+    case CLIP_GUARD_BOTTOM: return v.y + CLIP_GUARD_BAND * v.w;
+    case CLIP_GUARD_TOP:    return CLIP_GUARD_BAND * v.w - v.y;
+    }
+    return 0.0f;
+}
+
+inline float3 perspectiveDivide(float4 const& v) {
+    auto w = 1 / v.w;
+    return float3(v.x * w, v.y * w, v.z * w);
+}
+
+/**
+ * Clip coordinates of a mesh under a transform shared by instances that only
+ * differ by a translation in model space. Vertices are transformed once, the
+ * clip coordinates of an instance translated by t are clip + offset(t).
+ */
+struct SharedTransform {
+    float4x4 mvp;
+    std::vector<float4> clip;
+
+    void update(TriangleMesh const& mesh, float4x4 const& _mvp) {
+        mvp = _mvp;
+        clip.resize(mesh.vertices.size());
+        for (size_t i = 0; i < clip.size(); ++i) {
+            clip[i] = mvp * float4(mesh.vertices[i], 1.0f);
+        }
+    }
+
+    float4 offset(float3 const& translation) const {
+        return mvp * float4(translation, 0.0f);
+    }
+};
+
+struct VertexStage {
+
+    struct Triangle {
+        int v[3]; // index into ndc
+        int id;   // index of the source triangle in the full detail mesh
+    };
+
+    std::vector<float3> ndc;           // mesh vertices, then vertices created by clipping
+    std::vector<Triangle> triangles;   // triangles that may be visible
+    float3 min, max;                   // NDC bounds of all vertices of emitted triangles
+    MeshletCuller culler;
+    // If set, vertices are not transformed by mvp but offset from the shared
+    // clip coordinates. mvp must still be the full transform of the instance.
+    SharedTransform const* shared = nullptr;
+    float4 shared_offset;
+
+    /**
+     * Transform and clip a mesh, returns false if the mesh is outside the view volume.
+     * - NDC of vertices behind the near plane are left undefined, no emitted triangle uses them.
+     * - Triangles outside one of the frustum planes are dropped.
+     * - With cull_meshlets, only vertices and triangles of meshlets that pass
+     *   the culler are processed, and false is returned if no triangle is left.
+     */
+    bool process(TriangleMesh const& mesh, float4x4 const& mvp, bool cull_meshlets = false) {
+        auto vertex_num = mesh.vertices.size();
+        clip.resize(vertex_num);
+        codes.resize(vertex_num);
+        ndc.resize(vertex_num);
+        triangles.clear();
+
+        min = float3(std::numeric_limits<float>::max());
+        max = float3(std::numeric_limits<float>::lowest());
+
+        if (cull_meshlets && !mesh.meshlets.empty()) {
+            culler.setup(mvp);
+            transformed.assign(vertex_num, 0);
+            for (auto const& m : mesh.meshlets) {
+                if (!culler.visible(m)) continue;
+                for (int i = m.first; i < m.first + m.count; ++i) {
+                    auto const& index = mesh.indices[i];
+                    for (int j = 0; j < 3; ++j) {
+                        if (transformed[index[j]]) continue;
+                        transformed[index[j]] = 1;
+                        transformVertex(mesh, mvp, index[j]);
+                    }
+                    processTriangle(index, mesh.sourceTriangle(i));
+                }
+            }
+            return !triangles.empty();
+        }
+
+        unsigned int codes_and = ~0u;
+        for (size_t i = 0; i < vertex_num; ++i) {
+            codes_and &= transformVertex(mesh, mvp, i);
+        }
+
+        // Cull mesh if all vertices are outside the same plane.
+        if (codes_and & CLIP_FRUSTUM) return false;
+
+        for (size_t i = 0; i < mesh.indices.size(); ++i) {
+            processTriangle(mesh.indices[i], mesh.sourceTriangle(i));
+        }
+        return true;
+    }
+
+private:
+    std::vector<float4> clip;
+    std::vector<unsigned int> codes;
+    std::vector<char> transformed;
+
+    unsigned int transformVertex(TriangleMesh const& mesh, float4x4 const& mvp, size_t i) {
+        auto v = shared ? shared->clip[i] + shared_offset : mvp * float4(mesh.vertices[i], 1.0f);
+        auto code = clipCode(v);
+        clip[i] = v;
+        codes[i] = code;
+        if (code & CLIP_NEAR) return code;
+        ndc[i] = perspectiveDivide(v);
+        // Vertices outside the guard band are only used by clipped triangles.
+        if (code & CLIP_PLANES) return code;
+        min = float3::min(min, ndc[i]);
+        max = float3::max(max, ndc[i]);
+        return code;
+    }
+
+    void processTriangle(int3 const& index, size_t i) {
+        auto c0 = codes[index[0]];
+        auto c1 = codes[index[1]];
+        auto c2 = codes[index[2]];
+        if (c0 & c1 & c2 & CLIP_FRUSTUM) {
+            STATS_INC(triangles_frustum_culled);
+            return;
+        }
+        auto planes = (c0 | c1 | c2) & CLIP_PLANES;
+        if (planes == 0) {
+            triangles.push_back({ { index[0], index[1], index[2] }, (int)i });
+            return;
+        }
+        clipTriangle(index, planes, i);
+    }
+
+    // Sutherland-Hodgman clipping of one triangle against the given planes,
+    // the resulting convex polygon is emitted as a triangle fan.
+    void clipTriangle(int3 const& index, unsigned int planes, size_t id) {
+        // Each plane adds at most one vertex.
+        float4 buffer[2][8];
+        int count = 3;
+        auto input = buffer[0];
+        auto output = buffer[1];
+        input[0] = clip[index[0]];
+        input[1] = clip[index[1]];
+        input[2] = clip[index[2]];
+
+        for (unsigned int plane = CLIP_NEAR; plane <= CLIP_GUARD_TOP; plane <<= 1) {
+            if (!(planes & plane)) continue;
+            int out_count = 0;
+            for (int i = 0; i < count; ++i) {
+                auto const& a = input[i];
+                auto const& b = input[(i + 1) % count];
+                auto da = clipDistance(a, plane);
+                auto db = clipDistance(b, plane);
+                if (da >= 0) output[out_count++] = a;
+                if ((da >= 0) != (db >= 0)) {
+                    auto t = da / (da - db);
+                    output[out_count++] = a + (b - a) * t;
+                }
+            }
+            std::swap(input, output);
+            count = out_count;
+            if (count < 3) return;
+        }
+
+        int first = ndc.size();
+        for (int i = 0; i < count; ++i) {
+            ndc.push_back(perspectiveDivide(input[i]));
+            min = float3::min(min, ndc.back());
+            max = float3::max(max, ndc.back());
+        }
+        for (int i = 1; i + 1 < count; ++i) {
+            triangles.push_back({ { first, first + i, first + i + 1 }, (int)id });
+        }
+    }
+};
@@ -0,0 +1,100 @@
+/**
+ * Background encoder for frame sequences.
+ * Frames are copied into a recycled buffer and encoded by a pool of worker
+ * threads, so that encoding overlaps rendering of the next frames.
+ * How to use:
+ *  1. Create the writer with the number of threads and the maximum number
+ *     of frames waiting to be encoded:
+ *      ```
+ *      FrameWriter writer(2, 4);
+ *      ```
+ *  2. Submit frames every render loop, submission only blocks when the
+ *     queue is full:
+ *      ```
+ *      writer.writeColor(image, "frame_0000.png", ColorFileFormat::PNG);
+ *      writer.writeDepth(depth, w, h, "depth_0000.pfm", DepthFileFormat::PFM);
+ *      ```
+ *  3. Frames still in the queue are written by flush() or on destruction.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "image.h"
+
+enum struct ColorFileFormat {
+    PNG,    // 8-bit RGB(A) PNG
+    PPM,    // binary P6 PPM, no compression
+};
+
+enum struct DepthFileFormat {
+    PNG8,   // 8-bit grayscale PNG
+    PNG16,  // 16-bit grayscale PNG
+    PFM,    // 32-bit float grayscale PFM, raw depth values
+};
+
+struct FrameWriter {
+    // zlib effort used for PNG files, 5 is the fastest level of the built-in compressor.
+    int png_level = 5;
+
+    FrameWriter(int thread_num = 2, int queue_depth = 4);
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    // Fills blocks of image still pending from a fast clear before copying it.
+    void writeColor(Image & image, std::string const& path, ColorFileFormat format);
+
+    /**
+     * Depth buffer rows are ordered from bottom to top like ZBuffer, and
+     * values in [0, 1] are mapped to the full range of integer formats.
+     */
+    void writeDepth(float const* depth, int width, int height, std::string const& path, DepthFileFormat format);
+
+    // Block until all submitted frames are written.
+    void flush();
+
+private:
+    struct Job {
+        std::string path;
+        int width;
+        int height;
+        int channels;
+        bool is_depth;
+        ColorFileFormat color_format;
+        DepthFileFormat depth_format;
+        std::vector<unsigned char> pixels; // tightly packed rows from top to bottom
+        std::vector<float> depth;          // rows from bottom to top
+    };
+
+    int queue_depth;
+    int busy = 0;
+    bool stop = false;
+    std::deque<Job> queue;
+    std::vector<Job> spare; // finished jobs kept to reuse their buffers
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+
+    Job acquire();
+    void submit(Job && job);
+    void work();
+    void encode(Job const& job) const;
+};
+
+/**
+ * Synchronous encoders used by FrameWriter, safe to call from multiple threads.
+ * - Rows are tightly packed and ordered from top to bottom, except for PFM.
+ * - 16-bit samples are passed in native byte order.
+ */
+bool writePNG(std::string const& path, int width, int height, int channels, int bit_depth,
+              void const* rows, int level);
+bool writePPM(std::string const& path, int width, int height, int channels, unsigned char const* rows);
+bool writePFM(std::string const& path, int width, int height, float const* rows_bottom_up);
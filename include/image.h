@@ -1,26 +1,140 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
 #include "vector.h"
 
+// Color quantized to 8 bits per channel, packed as 0xAABBGGRR.
+using color8 = unsigned int;
+
+color8 quantize(colorf const& color);
+
+// Alignment in bytes of image data and of rows in 4-channel images.
+#define IMAGE_ALIGNMENT 64
+// Pixels of a row per fast clear block.
+#define IMAGE_CLEAR_BLOCK 64
+
+/**
+ * 8-bit image used as render target, rows are stored from top to bottom.
+ * - 3 channels: tightly packed RGB rows.
+ * - 4 channels: RGBA rows padded to IMAGE_ALIGNMENT bytes, so that each
+ *   pixel is an aligned 32-bit word and each row starts on a cache line.
+ * fill() only flags blocks of IMAGE_CLEAR_BLOCK pixels of a row as cleared,
+ * the first write to a block stores the clear color in it. Call
+ * resolveClear() before reading data directly.
+ */
 struct Image {
     using dataType = unsigned char;
     dataType *data;
-    constexpr int channel() const { return 3; }
+    int channels;
+    int stride; // bytes per row
     int width, height;
 
-    Image(int w, int h);
+    int channel() const { return channels; }
+
+    Image(int w, int h, int c = 3);
     ~Image();
 
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+
     void fill(colorf const& color);
+    void fill(color8 color);
+    // Stores the clear color in blocks not written since fill().
+    void resolveClear();
     void setPixel(int x, int y, colorf const& color);
     void writePNG(std::string const& path);
+
+    /**
+     * Fast paths for rasterizers writing pre-quantized colors.
+     * - Coordinates must be inside the image, they are only checked by assert.
+     * - writeSpan() fills pixels [x0, x1] of row y.
+     * - readPixel() of a 3-channel image returns an opaque color.
+     * - row() bypasses clear flags, like data.
+     */
+    dataType* row(int y) {
+        assert(y >= 0 && y < height);
+        return data + (height - 1 - y) * stride;
+    }
+
+    // 4-channel pixels are stored as a single 32-bit word, which
+    // gives RGBA byte order on little-endian platforms.
+    void writePixel(int x, int y, color8 color) {
+        assert(x >= 0 && x < width);
+        touch(x, y);
+        auto p = row(y) + x * channels;
+        if (channels == 4) {
+            memcpy(p, &color, sizeof(color8));
+            return;
+        }
+        p[0] = color & 0xff;
+        p[1] = (color >> 8) & 0xff;
+        p[2] = (color >> 16) & 0xff;
+    }
+
+    color8 readPixel(int x, int y) {
+        assert(x >= 0 && x < width);
+        if (cleared[y * blocks_x + x / IMAGE_CLEAR_BLOCK]) {
+            return channels == 4 ? clear_color : clear_color | 0xff000000u;
+        }
+        auto p = row(y) + x * channels;
+        color8 color;
+        if (channels == 4) {
+            memcpy(&color, p, sizeof(color8));
+            return color;
+        }
+        return p[0] | (p[1] << 8) | (p[2] << 16) | 0xff000000u;
+    }
+
+    void writeSpan(int x0, int x1, int y, color8 color) {
+        assert(x0 >= 0 && x1 < width);
+        // Blocks covered by the span need no clear.
+        for (int b = x0 / IMAGE_CLEAR_BLOCK; b <= x1 / IMAGE_CLEAR_BLOCK; ++b) {
+            if (x0 <= b * IMAGE_CLEAR_BLOCK && x1 >= std::min((b + 1) * IMAGE_CLEAR_BLOCK, width) - 1) {
+                cleared[y * blocks_x + b] = 0;
+            }
+            else touch(b * IMAGE_CLEAR_BLOCK, y);
+        }
+        fillSpan(x0, x1, y, color);
+    }
     
     /**
      * Rasterize a line using Bresenham algorithm.
      * - Input coordinates are in image space. 
      */
     void drawLine(int2 const& v0, int2 const& v1, colorf const& color);
+
+private:
+    dataType *storage; // unaligned allocation holding data
+    int blocks_x; // clear blocks per row
+    std::vector<unsigned char> cleared; // per block
+    color8 clear_color = 0;
+
+    void touch(int x, int y) {
+        auto & flag = cleared[y * blocks_x + x / IMAGE_CLEAR_BLOCK];
+        if (!flag) return;
+        flag = 0;
+        int x0 = x / IMAGE_CLEAR_BLOCK * IMAGE_CLEAR_BLOCK;
+        fillSpan(x0, std::min(x0 + IMAGE_CLEAR_BLOCK, width) - 1, y, clear_color);
+    }
+
+    void fillSpan(int x0, int x1, int y, color8 color) {
+        auto p = row(y) + x0 * channels;
+        if (channels == 4) {
+            for (int x = x0; x <= x1; ++x, p += 4) {
+                memcpy(p, &color, sizeof(color8));
+            }
+            return;
+        }
+        for (int x = x0; x <= x1; ++x, p += 3) {
+            p[0] = color & 0xff;
+            p[1] = (color >> 8) & 0xff;
+            p[2] = (color >> 16) & 0xff;
+        }
+    }
 };
 
 void writeDepthToPNG(std::string const& path, int width, int height, float* depth);
@@ -6,14 +6,71 @@
 #include "vector.h"
 
 #define MAX_LINE_NUM 256
+// Maximum number of triangles in a meshlet.
+#define MESHLET_MAX_TRIANGLES 64
+// Size of the simulated vertex cache used to order triangles.
+#define VERTEX_CACHE_SIZE 32
+// Number of levels of detail, including the full detail mesh.
+#define LOD_LEVELS 4
+// Each level keeps 1 / LOD_REDUCTION of the triangles of the previous one.
+#define LOD_REDUCTION 4
+// Meshes are not simplified below this number of triangles.
+#define LOD_MIN_TRIANGLES 256
+// Version of .lod cache files, caches of other versions are rebuilt.
+#define LOD_CACHE_VERSION 3
+
+// Cluster of consecutive triangles in indices, culled as a whole.
+struct Meshlet {
+    int first;          // first triangle in indices
+    int count;
+    float3 center;      // bounding sphere
+    float radius;
+    // Normal cone, the normal of every triangle is within the cone around axis.
+    float3 cone_axis;
+    float cone_cutoff;  // sine of the cone angle, 1 if the cone is too wide to cull
+};
 
 struct TriangleMesh {
     std::vector<float3> vertices;
     std::vector<int3> indices;
+    std::vector<Meshlet> meshlets;
     float3 center;
     float3 min;
     float3 max;
+    // Face of the .obj file each triangle comes from, through reordering on
+    // load and simplification. Triangle ids are these, so that they match the
+    // file and simplified levels share the colors of the full detail mesh.
+    std::vector<int> source;
+    // Simplified levels of detail, from fine to coarse.
+    std::vector<TriangleMesh> lods;
 
     TriangleMesh() = delete;
-    TriangleMesh(std::string const& path);
+    // With reorder, triangles and vertices are reordered for vertex reuse after loading,
+    // otherwise triangles are only sorted in Morton order and vertices keep the file order.
+    // With lod, levels of detail are built, or loaded from the cache file path + ".lod".
+    TriangleMesh(std::string const& path, bool reorder = true, bool lod = false);
+    // Level of detail, reordered for vertex reuse.
+    TriangleMesh(std::vector<float3> const& _vertices,
+                 std::vector<int3> const& _indices,
+                 std::vector<int> const& _source);
+
+    int levels() const { return 1 + lods.size(); }
+    // Level 0 is the full detail mesh.
+    TriangleMesh const& level(int l) const { return l == 0 ? *this : lods[l - 1]; }
+    int sourceTriangle(int i) const { return source.empty() ? i : source[i]; }
+
+    // Sort triangles along a Morton curve of their centroids.
+    void sortTriangles();
+    // Reorder triangles for vertex reuse with Tom Forsyth's greedy algorithm,
+    // then number vertices in the order they are first used.
+    void optimizeVertexOrder();
+    // Split consecutive triangles into meshlets.
+    void buildMeshlets();
+    // Simplify each level from the previous one by quadric edge collapse,
+    // unless the cache file holds levels built from the same mesh.
+    void buildLODs(std::string const& cache_path);
+
+private:
+    bool loadLODs(std::string const& cache_path, unsigned int checksum);
+    void saveLODs(std::string const& cache_path, unsigned int checksum) const;
 };
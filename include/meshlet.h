@@ -0,0 +1,124 @@
+/**
+ * Culling of whole meshlets before their triangles are transformed.
+ * How to use:
+ *  1. Optionally give the culler a depth pyramid for occlusion tests:
+ *      ```
+ *      MeshletCuller culler;
+ *      culler.depth = &hierarchical_z_buffer;
+ *      ```
+ *  2. Setup with the transform of a mesh, then test its meshlets:
+ *      ```
+ *      culler.setup(mvp);
+ *      for (auto const& m : mesh.meshlets) {
+ *          if (!culler.visible(m)) continue;
+ *          ...
+ *      }
+ *      ```
+ * All tests are conservative, a meshlet is only rejected if none of its
+ * triangles would pass back-face culling, frustum culling and depth test.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include "vector.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "buffer.h"
+#include "stats.h"
+
+struct MeshletCuller {
+    // Depth pyramid to test meshlets against, occlusion is not tested if null.
+    HierarchicalZBuffer const* depth = nullptr;
+
+    void setup(float4x4 const& _mvp) {
+        mvp = _mvp;
+        auto x = mvp.row(0);
+        auto y = mvp.row(1);
+        auto z = mvp.row(2);
+        auto w = mvp.row(3);
+
+        // Clip volume -w <= x, y <= w, 0 <= z <= w in model space.
+        float4 const planes[6] = { w + x, w - x, w + y, w - y, z, w - z };
+        for (int i = 0; i < 6; ++i) {
+            auto n = float3(planes[i]);
+            frustum[i] = planes[i] / std::sqrt(n.dot(n));
+        }
+
+        // Homogeneous eye position e in model space, the point that projects
+        // to x = y = w = 0. Its w is 0 for orthographic projections.
+        // Screen winding of a triangle with normal n at p has the sign of
+        // dot(n, e.w * p - e.xyz), which is negative for back faces.
+        eye = float4(
+             det3(x.y, x.z, x.w, y.y, y.z, y.w, w.y, w.z, w.w),
+            -det3(x.x, x.z, x.w, y.x, y.z, y.w, w.x, w.z, w.w),
+             det3(x.x, x.y, x.w, y.x, y.y, y.w, w.x, w.y, w.w),
+            -det3(x.x, x.y, x.z, y.x, y.y, y.z, w.x, w.y, w.z));
+    }
+
+    bool visible(Meshlet const& m) const {
+        STATS_INC(meshlets_tested);
+
+        for (int i = 0; i < 6; ++i) {
+            if (frustum[i].dot(float4(m.center, 1.0f)) < -m.radius) {
+                STATS_INC(meshlets_frustum_culled);
+                return false;
+            }
+        }
+
+        // Back-facing if the direction from the eye is outside of the
+        // normal cone for every point of the bounding sphere.
+        auto view = m.center * eye.w - float3(eye);
+        auto distance = std::sqrt(view.dot(view));
+        if (view.dot(m.cone_axis) > m.cone_cutoff * distance + m.radius * std::abs(eye.w)) {
+            STATS_INC(meshlets_backface_culled);
+            return false;
+        }
+
+        if (depth && occluded(m.center, m.radius)) {
+            STATS_INC(meshlets_occluded);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Project the bounding box of a sphere in model space and test its
+     * nearest depth against the pyramid, which must be set.
+     */
+    bool occluded(float3 const& center, float radius) const {
+        auto min = float3(std::numeric_limits<float>::max());
+        auto max = float3(std::numeric_limits<float>::lowest());
+        for (int i = 0; i < 8; ++i) {
+            auto corner = center + float3(i & 1 ? radius : -radius,
+                                          i & 2 ? radius : -radius,
+                                          i & 4 ? radius : -radius);
+            auto v = mvp * float4(corner, 1.0f);
+            // Crossing the near plane, the projected bound is unknown.
+            if (v.w <= 0 || v.z < 0) return false;
+            auto ndc = float3(v) / v.w;
+            min = float3::min(min, ndc);
+            max = float3::max(max, ndc);
+        }
+
+        auto width = depth->width;
+        auto height = depth->height;
+        auto x_min = clamp((int)std::floor((min.x * 0.5f + 0.5f) * width), 0, width - 1);
+        auto x_max = clamp((int)std::floor((max.x * 0.5f + 0.5f) * width), 0, width - 1);
+        auto y_min = clamp((int)std::floor((min.y * 0.5f + 0.5f) * height), 0, height - 1);
+        auto y_max = clamp((int)std::floor((max.y * 0.5f + 0.5f) * height), 0, height - 1);
+        return depth->occluded(x_min, x_max, y_min, y_max, min.z);
+    }
+
+private:
+    float4x4 mvp;
+    float4 frustum[6];
+    float4 eye;
+
+    static float det3(float a, float b, float c,
+                      float d, float e, float f,
+                      float g, float h, float i) {
+        return a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+    }
+};
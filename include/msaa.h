@@ -0,0 +1,240 @@
+/**
+ * Multi-sample depth and colors, compressed per tile of pixels.
+ * A tile is in one of three modes:
+ *  - Clear:    every sample has the clear depth and shows the image below;
+ *  - Plane:    one triangle covers every sample, only its depth plane, color
+ *              and id are stored;
+ *  - Expanded: per-sample depth and color, allocated from a pool on the
+ *              first partial write since the last clear.
+ * Clearing only resets tiles, and memory grows with the number of tiles
+ * crossed by triangle edges instead of with samples times pixels.
+ * How to use:
+ *  1. Create with the size of the framebuffer and 4 or 8 samples:
+ *      ```
+ *      MSAABuffer msaa(width, height, 4);
+ *      ```
+ *  2. Clear before each frame, rasterizers then read and write tiles:
+ *      ```
+ *      msaa.clear();
+ *      auto & tile = msaa.tile(tx, ty);
+ *      if (tile.mode != MSAABuffer::TileMode::Expanded) msaa.expand(tx, ty, image);
+ *      msaa.depth(tile, p, s) = z;
+ *      ```
+ *  3. Average the samples of each pixel into the image:
+ *      ```
+ *      msaa.resolve(image);
+ *      ```
+ */
+
+#pragma once
+
+#include <vector>
+#include <cassert>
+#include <algorithm>
+#include "vector.h"
+#include "image.h"
+#include "subpixel.h"
+#include "stats.h"
+#include "buffer.h"
+
+// Pixels per side of a tile.
+#define MSAA_TILE_SIZE 8
+#define MSAA_TILE_PIXELS (MSAA_TILE_SIZE * MSAA_TILE_SIZE)
+#define MSAA_MAX_SAMPLES 8
+
+struct MSAABuffer {
+
+    enum struct TileMode : unsigned char {
+        Clear,
+        Plane,
+        Expanded,
+    };
+
+    struct Tile {
+        TileMode mode;
+        // No sample of the tile is nearer than z_min or farther than z_max,
+        // z_max is not lowered by writes to expanded tiles.
+        float z_min;
+        float z_max;
+        // Plane: reciprocal depth is plane.x * u + plane.y * v + plane.z at
+        // (u, v) pixels away from the center of the first pixel of the tile.
+        float3 plane;
+        color8 color;
+        visibility_id id;
+        // Samples of the tile start at block * MSAA_TILE_PIXELS * samples,
+        // -1 until the tile is first expanded after a clear. A tile set to a
+        // plane keeps its block.
+        int block;
+    };
+
+    int width, height;
+    int samples;
+    int tiles_x, tiles_y;
+    std::vector<Tile> tiles;
+    // Sample positions relative to the pixel center, in subpixels and in pixels.
+    int2 offset[MSAA_MAX_SAMPLES];
+    float2 position[MSAA_MAX_SAMPLES];
+
+    MSAABuffer(int w, int h, int s)
+        : width(w)
+        , height(h)
+        , samples(s)
+        , tiles_x((w + MSAA_TILE_SIZE - 1) / MSAA_TILE_SIZE)
+        , tiles_y((h + MSAA_TILE_SIZE - 1) / MSAA_TILE_SIZE)
+        , tiles(tiles_x * tiles_y) {
+        assert(s == 4 || s == 8);
+        // Standard 4x and 8x patterns in 1/16 pixel, no two samples share a
+        // row or a column.
+        static int const pattern4[4][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+        static int const pattern8[8][2] = {
+            { 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 }, { -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 },
+        };
+        for (int i = 0; i < s; ++i) {
+            auto p = s == 4 ? pattern4[i] : pattern8[i];
+            offset[i] = int2(p[0] * SUBPIXEL_ONE / 16, p[1] * SUBPIXEL_ONE / 16);
+            position[i] = float2(p[0] / 16.0f, p[1] / 16.0f);
+        }
+        clear();
+    }
+
+    Tile & tile(int tx, int ty) {
+        assert(tx >= 0 && tx < tiles_x);
+        assert(ty >= 0 && ty < tiles_y);
+        return tiles[ty * tiles_x + tx];
+    }
+
+    void clear() {
+        for (auto & t : tiles) {
+            t.mode = TileMode::Clear;
+            t.z_min = 1.0f;
+            t.z_max = 1.0f;
+            t.block = -1;
+        }
+        blocks = 0;
+    }
+
+    // Depth of sample s of pixel p, p indexes pixels of the tile in rows.
+    float sampleDepth(Tile const& t, int p, int s) const {
+        switch (t.mode) {
+        case TileMode::Clear:
+            return 1.0f;
+        case TileMode::Plane: {
+            auto u = p % MSAA_TILE_SIZE + position[s].x;
+            auto v = p / MSAA_TILE_SIZE + position[s].y;
+            return 1.0f / (t.plane.x * u + t.plane.y * v + t.plane.z);
+        }
+        case TileMode::Expanded:
+            break;
+        }
+        return depth(t, p, s);
+    }
+
+    // Samples of expanded tiles.
+    float & depth(Tile const& t, int p, int s) {
+        assert(t.mode == TileMode::Expanded);
+        return depths[(t.block * MSAA_TILE_PIXELS + p) * samples + s];
+    }
+    float depth(Tile const& t, int p, int s) const {
+        assert(t.mode == TileMode::Expanded);
+        return depths[(t.block * MSAA_TILE_PIXELS + p) * samples + s];
+    }
+    color8 & color(Tile const& t, int p, int s) {
+        assert(t.mode == TileMode::Expanded);
+        return colors[(t.block * MSAA_TILE_PIXELS + p) * samples + s];
+    }
+
+    // Covers every sample of tile (tx, ty) with a triangle.
+    void setPlane(int tx, int ty, float3 const& plane, float z_min, float z_max,
+                  color8 color, visibility_id id) {
+        auto & t = tile(tx, ty);
+        t.mode = TileMode::Plane;
+        t.plane = plane;
+        t.z_min = z_min;
+        t.z_max = z_max;
+        t.color = color;
+        t.id = id;
+    }
+
+    /**
+     * Stores every sample of tile (tx, ty) separately. Samples of a clear
+     * tile take the color of their pixel in image, which must not be written
+     * before resolve().
+     */
+    void expand(int tx, int ty, Image & image) {
+        auto & t = tile(tx, ty);
+        if (t.mode == TileMode::Expanded) return;
+
+        if (t.block < 0) {
+            t.block = blocks++;
+            size_t size = (size_t)blocks * MSAA_TILE_PIXELS * samples;
+            if (depths.size() < size) {
+                depths.resize(size);
+                colors.resize(size);
+            }
+        }
+        auto mode = t.mode;
+        t.mode = TileMode::Expanded;
+        for (int p = 0; p < MSAA_TILE_PIXELS; ++p) {
+            int x = tx * MSAA_TILE_SIZE + p % MSAA_TILE_SIZE;
+            int y = ty * MSAA_TILE_SIZE + p / MSAA_TILE_SIZE;
+            color8 background = 0;
+            if (mode == TileMode::Clear && x < width && y < height) background = image.readPixel(x, y);
+            for (int s = 0; s < samples; ++s) {
+                if (mode == TileMode::Clear) {
+                    depth(t, p, s) = 1.0f;
+                    color(t, p, s) = background;
+                }
+                else {
+                    auto u = p % MSAA_TILE_SIZE + position[s].x;
+                    auto v = p / MSAA_TILE_SIZE + position[s].y;
+                    depth(t, p, s) = 1.0f / (t.plane.x * u + t.plane.y * v + t.plane.z);
+                    color(t, p, s) = t.color;
+                }
+            }
+        }
+    }
+
+    // Writes the average color of the samples of each pixel of tiles not clear.
+    void resolve(Image & image) {
+        for (int ty = 0; ty < tiles_y; ++ty) for (int tx = 0; tx < tiles_x; ++tx) {
+            auto const& t = tile(tx, ty);
+            int x0 = tx * MSAA_TILE_SIZE;
+            int y0 = ty * MSAA_TILE_SIZE;
+            int x1 = std::min(x0 + MSAA_TILE_SIZE, width) - 1;
+            int y1 = std::min(y0 + MSAA_TILE_SIZE, height) - 1;
+            switch (t.mode) {
+            case TileMode::Clear:
+                break;
+            case TileMode::Plane:
+                STATS_INC(msaa_tiles_plane);
+                for (int y = y0; y <= y1; ++y) image.writeSpan(x0, x1, y, t.color);
+                break;
+            case TileMode::Expanded:
+                STATS_INC(msaa_tiles_expanded);
+                for (int y = y0; y <= y1; ++y) for (int x = x0; x <= x1; ++x) {
+                    auto c = &colors[(t.block * MSAA_TILE_PIXELS + (y - y0) * MSAA_TILE_SIZE + (x - x0)) * samples];
+                    unsigned int sum[4] = { 0, 0, 0, 0 };
+                    for (int s = 0; s < samples; ++s) {
+                        for (int k = 0; k < 4; ++k) sum[k] += (c[s] >> (k * 8)) & 0xff;
+                    }
+                    color8 average = 0;
+                    for (int k = 0; k < 4; ++k) average |= ((sum[k] + samples / 2) / samples) << (k * 8);
+                    image.writePixel(x, y, average);
+                }
+                break;
+            }
+        }
+    }
+
+    // Bytes of tiles and of samples of the tiles expanded since the last clear.
+    size_t memoryUsed() const {
+        return tiles.size() * sizeof(Tile)
+             + (size_t)blocks * MSAA_TILE_PIXELS * samples * (sizeof(float) + sizeof(color8));
+    }
+
+private:
+    // Expanded tiles since the last clear, the pools keep their capacity.
+    int blocks = 0;
+    std::vector<float> depths;
+    std::vector<color8> colors;
+};
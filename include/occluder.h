@@ -0,0 +1,210 @@
+/**
+ * Low resolution depth of selected occluders, drawn before the frame so that
+ * other meshes can be culled before any of them is rasterized.
+ * How to use:
+ *  1. Create with the size of the framebuffer, depth is kept at
+ *     1 / OCCLUDER_DOWNSCALE of it:
+ *      ```
+ *      OccluderBuffer occluders(512, 512);
+ *      ```
+ *  2. Set the raster mode, then clear and draw occluder meshes every frame:
+ *      ```
+ *      occluders.subpixel = subpixel;
+ *      occluders.msaa = msaa;              // nullptr without multi-sampling
+ *      occluders.clear();
+ *      occluders.drawMesh(mesh, mvp);
+ *      ```
+ *  3. Test other meshes against the pyramid built from them:
+ *      ```
+ *      OcclusionQueries queries(occluders.depth.width, occluders.depth.height);
+ *      queries.add(mesh.min, mesh.max, mvp);
+ *      occluders.depth.query(queries);
+ *      ```
+ * Rasterization is conservative. Triangles of occluders mark the framebuffer
+ * pixels they cover in a mask per occluder pixel, which is only written once
+ * all of its framebuffer pixels are covered, with the farthest depth of the
+ * triangles covering them. Fine meshes occlude as well as a few large
+ * triangles.
+ * Coverage follows the raster mode of the frame, so that a pixel is only
+ * marked if the rasterizers draw it: vertices snapped to pixels and samples
+ * on them, or 24.8 fixed point with the top-left rule at pixel centers. With
+ * multi-sample anti-aliasing there is a mask per sample, and a pixel is
+ * covered once all of its samples are.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include "vector.h"
+#include "matrix.h"
+#include "utils.h"
+#include "mesh.h"
+#include "buffer.h"
+#include "clipping.h"
+#include "subpixel.h"
+#include "msaa.h"
+
+// Ratio of framebuffer size to occluder depth size, each occluder pixel
+// covers 4x4 framebuffer pixels, one bit of its coverage mask each.
+#define OCCLUDER_DOWNSCALE 4
+#define OCCLUDER_FULL_COVERAGE 0xffff
+// Number of instances with the largest bounds on screen drawn as occluders.
+#define OCCLUDER_INSTANCES 4
+
+struct OccluderBuffer {
+    int width;
+    int height;
+    HierarchicalZBuffer depth;
+    VertexStage vertex_stage;
+    // Raster mode of the frame, see above. Only the sample positions of the
+    // multi-sample buffer are used.
+    bool subpixel = false;
+    MSAABuffer const* msaa = nullptr;
+
+    OccluderBuffer(int w, int h)
+        : width(w)
+        , height(h)
+        , depth(w / OCCLUDER_DOWNSCALE, h / OCCLUDER_DOWNSCALE)
+        , coverage(depth.width * depth.height)
+        , coverage_z(depth.width * depth.height) {}
+
+    void clear() {
+        depth.clear(1.0f);
+        coverage.assign(depth.width * depth.height * samples(), 0);
+        std::fill(coverage_z.begin(), coverage_z.end(), std::numeric_limits<float>::lowest());
+    }
+
+    void drawMesh(TriangleMesh const& mesh, float4x4 const& mvp) {
+        if (!vertex_stage.process(mesh, mvp, true)) return;
+
+        auto const& ndc = vertex_stage.ndc;
+        for (auto const& triangle : vertex_stage.triangles) {
+            float3 v[3];
+            for (int i = 0; i < 3; ++i) {
+                auto p = ndc[triangle.v[i]];
+                v[i] = float3((p.x * 0.5f + 0.5f) * width, (p.y * 0.5f + 0.5f) * height, p.z);
+            }
+
+            // Only front faces are drawn by the rasterizers.
+            auto area = edgeFunction2D(v[1], v[0], v[2]);
+            if (area <= 0) continue;
+
+            if (msaa) drawTriangleMSAA(v);
+            else if (subpixel) drawTriangleSubpixel(v);
+            else drawTriangle(v);
+        }
+    }
+
+private:
+    // Per occluder pixel, framebuffer pixels covered by the current layer
+    // of triangles and the farthest depth of those triangles.
+    // With multi-sample anti-aliasing, one mask per sample.
+    std::vector<unsigned short> coverage;
+    std::vector<float> coverage_z;
+
+    int samples() const { return msaa ? msaa->samples : 1; }
+
+    // Vertices are in framebuffer pixels, counter-clockwise. Snapped to
+    // pixels like the rasterizers, samples on an edge are covered.
+    void drawTriangle(float3 const* v) {
+        float3 s[3];
+        for (int i = 0; i < 3; ++i) s[i] = float3(ftoi(v[i].x), ftoi(v[i].y), v[i].z);
+        // Snapping may leave no area or flip the triangle, skipping it
+        // covers less and stays conservative.
+        if (edgeFunction2D(s[1], s[0], s[2]) <= 0) return;
+
+        // Edge functions E(x, y) = a * x + b * y + c at framebuffer pixels,
+        // positive inside.
+        float a[3], b[3], c[3];
+        for (int e = 0; e < 3; ++e) {
+            auto const& v0 = s[(e + 1) % 3];
+            auto const& v1 = s[(e + 2) % 3];
+            a[e] = v0.y - v1.y;
+            b[e] = v1.x - v0.x;
+            c[e] = v0.x * v1.y - v0.y * v1.x;
+        }
+        drawCoverage(s, a, b, c, 1);
+    }
+
+    void drawTriangleSubpixel(float3 const* v) {
+        FixedTriangle t;
+        if (!t.setup(v[0], v[1], v[2])) return;
+        // Edge functions of the fixed triangle, at pixel centers with the
+        // top-left bias folded in.
+        drawCoverage(v, t.a, t.b, t.c, 1);
+    }
+
+    void drawTriangleMSAA(float3 const* v) {
+        // Triangles between pixel centers may still cover samples.
+        FixedTriangle t;
+        if (!t.setup(v[0], v[1], v[2]) && t.area == 0) return;
+        // Edge functions of each sample, moved from the pixel center.
+        long long c[MSAA_MAX_SAMPLES * 3];
+        for (int s = 0; s < msaa->samples; ++s) {
+            for (int e = 0; e < 3; ++e) {
+                c[s * 3 + e] = t.c[e] + t.offset(e, msaa->offset[s].x, msaa->offset[s].y);
+            }
+        }
+        drawCoverage(v, t.a, t.b, c, msaa->samples);
+    }
+
+    /**
+     * Marks framebuffer pixels (x, y) with a * x + b * y + c >= 0 for all
+     * three edges in the masks of the occluder pixels overlapping the
+     * bounding box of v. c holds three edges for each of the given samples.
+     */
+    template<typename T>
+    void drawCoverage(float3 const* v, T const* a, T const* b, T const* c, int samples) {
+        int const n = OCCLUDER_DOWNSCALE;
+        auto min = float3::min(v[0], float3::min(v[1], v[2]));
+        auto max = float3::max(v[0], float3::max(v[1], v[2]));
+        // Occluder pixels overlapping the bounding box.
+        auto x_min = std::max(ftoi(min.x) / n, 0);
+        auto x_max = std::min(ftoi(max.x) / n, depth.width - 1);
+        auto y_min = std::max(ftoi(min.y) / n, 0);
+        auto y_max = std::min(ftoi(max.y) / n, depth.height - 1);
+        // The rasterizers interpolate reciprocals of depth, which never
+        // gives a depth farther than the farthest vertex.
+        auto z_far = max.z;
+
+        for (int y = y_min; y <= y_max; ++y) {
+            for (int x = x_min; x <= x_max; ++x) {
+                auto offset = y * depth.width + x;
+                auto masks = &coverage[offset * samples];
+                bool marked = false;
+                bool full = true;
+                for (int s = 0; s < samples; ++s) {
+                    auto cs = c + s * 3;
+                    // Coverage of the n * n framebuffer pixels, without branches.
+                    unsigned int mask = 0;
+                    for (int j = 0; j < n; ++j) {
+                        auto px = (T)(x * n);
+                        auto py = (T)(y * n + j);
+                        auto e0 = a[0] * px + b[0] * py + cs[0];
+                        auto e1 = a[1] * px + b[1] * py + cs[1];
+                        auto e2 = a[2] * px + b[2] * py + cs[2];
+                        for (int i = 0; i < n; ++i) {
+                            bool inside = (e0 + a[0] * i >= 0) & (e1 + a[1] * i >= 0) & (e2 + a[2] * i >= 0);
+                            mask |= (unsigned int)inside << (j * n + i);
+                        }
+                    }
+                    masks[s] |= mask;
+                    marked |= mask != 0;
+                    full &= masks[s] == OCCLUDER_FULL_COVERAGE;
+                }
+                if (!marked) continue;
+
+                coverage_z[offset] = std::max(coverage_z[offset], z_far);
+                if (!full) continue;
+
+                // Every framebuffer pixel is covered by the layer, start a new one.
+                if (coverage_z[offset] < depth.at(x, y, 0)) {
+                    depth.write(x, y, coverage_z[offset]);
+                }
+                std::fill(masks, masks + samples, 0);
+                coverage_z[offset] = std::numeric_limits<float>::lowest();
+            }
+        }
+    }
+};
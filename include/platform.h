@@ -36,7 +36,8 @@ namespace LuGL
     /**
      *  window
      */
-    AppWindow *createWindow(const char *title, long width, long height, byte_t *surface_buffer);
+    // surface_buffer holds RGB or RGBA rows of stride bytes, stride 0 means tightly packed rows.
+    AppWindow *createWindow(const char *title, long width, long height, byte_t *surface_buffer, int channels = 3, long stride = 0);
     void destroyWindow(AppWindow *window);
     void swapBuffer(AppWindow *window);
     bool windowShouldClose(AppWindow *window);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "utils.h"
+#include "vector.h"
+#include "image.h"
+#include "thread_pool.h"
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+// Rows of the image filled by one task, bands are spread over the threads.
+#define POLYGON_BAND_HEIGHT 16
+
+// Which points are inside a polygon whose contours overlap or intersect.
+enum struct FillRule {
+    EvenOdd,    // crossed by an odd number of edges
+    NonZero,    // edges going up and down do not cancel out
+};
+
+/**
+ * Polygon with any number of contours, concave or self-intersecting.
+ * - Vertices are in image space, pixel (x, y) covers [x, x + 1) * [y, y + 1).
+ * - Each contour is closed, its last vertex connects back to the first.
+ */
+struct Polygon {
+    std::vector<std::vector<float2>> contours;
+    color8 color;
+};
+
+/*
+ * * * Polygon Scan Conversion * * *
+ * Fills a batch of polygons with one sorted edge table and active edge lists,
+ * polygons later in the batch are drawn over earlier ones.
+ * A pixel is filled when its center is inside the polygon, so polygons sharing
+ * an edge neither overlap nor leave a gap.
+ * The image is split into bands of POLYGON_BAND_HEIGHT rows, filled in
+ * parallel, each with its own active edge list.
+ * How to use:
+ * - Init with image width and height, and optionally the number of threads:
+ *      auto filler = PolygonFill(w, h);
+ * - Fill polygons to image
+ *      filler.draw(
+ *          polygons,   // std::vector<Polygon> # polygons in drawing order.
+ *          rule,       // FillRule # EvenOdd or NonZero.
+ *          image       // Image    # Image as render target, for detail please refer to 'image.h'.
+ *      )
+ */
+
+struct PolygonFill {
+
+    // Sorted Edge Table, edges of all rows in one array, counting-sorted
+    // by the row where they become active. An edge crossing bands is
+    // stored once per band, starting at the first row of the band.
+    struct SortedEdgeTable {
+
+        // Edge struct for sorted edge table
+        struct Edge {
+            float x;    // x at the center of the current row
+            float dx;   // change of x per row
+            int y_max;  // last row crossed by the edge
+            int winding;// +1 if the edge goes towards larger y, -1 otherwise
+            int id;     // polygon index in the batch
+        };
+
+        // Edges of row y are [offset[y], offset[y + 1]).
+        std::vector<Edge> edges;
+        std::vector<int> offset;
+        // Rows crossed by any edge, y_first > y_last if there is none.
+        int y_first;
+        int y_last;
+
+        void build(std::vector<Polygon> const& polygons, int h);
+    };
+
+    int width, height;
+
+    PolygonFill(int w, int h, int thread_num = std::thread::hardware_concurrency())
+        : width(w)
+        , height(h)
+        , pool(std::max(thread_num, 1))
+        , bands(pool.size()) {}
+
+    void draw(std::vector<Polygon> const& polygons, FillRule rule, Image & image);
+
+private:
+    // State of the band filled by one thread, kept to reuse memory.
+    struct Band {
+        // Active edges, sorted by polygon and x.
+        std::vector<SortedEdgeTable::Edge> AEL;
+    };
+
+    ThreadPool pool;
+    std::vector<Band> bands; // one per thread
+    SortedEdgeTable SET;
+
+    // Fills rows [y0, y1] of the edge table.
+    void drawBand(Band & band, int y0, int y1, std::vector<Polygon> const& polygons,
+                  FillRule rule, Image & image);
+};
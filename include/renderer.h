@@ -0,0 +1,630 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include "vector.h"
+#include "matrix.h"
+#include "utils.h"
+#include "mesh.h"
+#include "image.h"
+#include "transform.h"
+#include "argparser.h"
+#include "zb_simple.h"
+#include "zb_scanline.h"
+#include "zb_hierarchical.h"
+#include "zb_octree.h"
+#include "meshlet.h"
+#include "occluder.h"
+#include "scene.h"
+#include "stats.h"
+
+// Levels of detail are picked so that each triangle covers at least this
+// many pixels of the projected bounding sphere.
+#define LOD_PIXELS_PER_TRIANGLE 2.0f
+
+/**
+ * Scene state shared by the viewer and the benchmark.
+ * Models are rotated by rotate_x and rotate_y, camera looks at the center
+ * of the mesh from z along z-axis.
+ */
+struct Camera {
+    float fov = PI() * 0.2;
+    float z = -6.0f;
+    float rotate_x = 0.0f;
+    float rotate_y = 0.0f;
+};
+
+inline float4x4 projection(ProjectionMode mode, Camera const& camera, int width, int height) {
+    auto aspect_ratio = (float)height / width;
+    switch (mode) {
+    case ProjectionMode::Perspective:
+        return perspective(camera.fov, aspect_ratio);
+    case ProjectionMode::Orthogonal:
+        return ortho(-2, 2, -2 * aspect_ratio, 1 * aspect_ratio, -1000, 1000);
+    }
+    return float4x4::identity();
+}
+
+// Flat diffuse shading of each triangle.
+inline std::vector<color8> shadeTriangles(TriangleMesh const& mesh, float3 const& light_dir) {
+    std::vector<color8> colors;
+    colors.reserve(mesh.indices.size());
+    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+        auto v0 = mesh.vertices[mesh.indices[i][0]];
+        auto v1 = mesh.vertices[mesh.indices[i][1]];
+        auto v2 = mesh.vertices[mesh.indices[i][2]];
+
+        auto e01 = v1 - v0;
+        auto e02 = v2 - v0;
+        auto normal = e01.cross(e02).normalized();
+        auto shading = clamp(light_dir.dot(normal), 0.05f, 1.0f);
+
+        colors.push_back(quantize(colorf(float3(shading), 1.0f)));
+    }
+    return colors;
+}
+
+/**
+ * Owns one rasterizer of each Z-Buffer algorithm and draws a grid of
+ * instances of a mesh, or the instances of a scene, with the selected one.
+ * How to use:
+ *  1. Create the renderer with the size of the framebuffer:
+ *      ```
+ *      Renderer renderer(512, 512);
+ *      ```
+ *  2. Draw (2 * c + 1) * (2 * c + 1) * n instances every frame:
+ *      ```
+ *      renderer.drawGrid(algorithm, mesh, colors, proj, camera, c, n, image);
+ *      ```
+ *     or every instance of a scene, with triangle colors of each of its meshes:
+ *      ```
+ *      renderer.drawScene(algorithm, scene, colors, proj, camera, image);
+ *      ```
+ */
+struct Renderer {
+    int width;
+    int height;
+    ZBSimple simpleZBuffer;
+    ZBScanline scanlineZBuffer;
+    ZBHierarchical hierarchicalZBuffer;
+    ZBOctree octreeZBuffer;
+    OccluderBuffer occluderBuffer;
+    bool deferred = false;
+    bool write_visibility = false;
+    bool count_overdraw = false;
+    bool subpixel = false;
+    bool cull_meshlets = true;
+    bool occluder_pass = false;
+    bool share_transform = true;
+    bool lod = false;
+    int samples = 1;
+    DepthFormat depth_format = DepthFormat::Float32;
+    DepthFormat pyramid_format = DepthFormat::Float32;
+    // Triangles of the meshes or levels of detail of all instances submitted
+    // in the last frame, before any culling.
+    long long submitted_triangles = 0;
+
+    Renderer(int w, int h)
+        : width(w)
+        , height(h)
+        , simpleZBuffer(w, h)
+        , scanlineZBuffer(w, h)
+        , hierarchicalZBuffer(w, h)
+        , octreeZBuffer(w, h)
+        , occluderBuffer(w, h) {}
+
+    void setDeferred(bool value) {
+        deferred = value;
+        simpleZBuffer.deferred = value;
+        scanlineZBuffer.deferred = value;
+        hierarchicalZBuffer.deferred = value;
+        octreeZBuffer.deferred = value;
+    }
+
+    void setWriteVisibility(bool value) {
+        write_visibility = value;
+        simpleZBuffer.write_visibility = value;
+        scanlineZBuffer.write_visibility = value;
+        hierarchicalZBuffer.write_visibility = value;
+        octreeZBuffer.write_visibility = value;
+    }
+
+    void setCountOverdraw(bool value) {
+        count_overdraw = value;
+        simpleZBuffer.count_overdraw = value;
+        scanlineZBuffer.count_overdraw = value;
+        hierarchicalZBuffer.count_overdraw = value;
+        octreeZBuffer.count_overdraw = value;
+    }
+
+    // Scanline Z-Buffer always snaps vertices to pixels.
+    void setSubpixel(bool value) {
+        subpixel = value;
+        simpleZBuffer.subpixel = value;
+        hierarchicalZBuffer.subpixel = value;
+        octreeZBuffer.subpixel = value;
+    }
+
+    void setCullMeshlets(bool value) {
+        cull_meshlets = value;
+        simpleZBuffer.cull_meshlets = value;
+        scanlineZBuffer.cull_meshlets = value;
+        hierarchicalZBuffer.cull_meshlets = value;
+        octreeZBuffer.cull_meshlets = value;
+    }
+
+    /**
+     * Two-phase occlusion culling for algorithms with a depth pyramid.
+     * Instances visible in the last frame are drawn first, then the others
+     * are tested against the pyramid built by them and only drawn if not
+     * occluded. Instances that wrote pixels and pass the final pyramid are
+     * visible in the next frame. Has no effect on Simple and Scanline Z-Buffer.
+     */
+    void setTwoPhase(bool value) {
+        two_phase = value;
+        last_visible.clear();
+    }
+
+    /**
+     * Occluder pass before every frame, for all algorithms. The instances
+     * with the largest projected bounds are drawn into the low resolution
+     * occluder buffer, and instances behind them are not drawn.
+     */
+    void setOccluderPass(bool value) {
+        occluder_pass = value;
+    }
+
+    /**
+     * Instances of the same mesh only differ by a translation, transform its
+     * vertices once per frame and offset them for each instance instead of
+     * transforming them again. Mathematically exact, rounding may differ.
+     */
+    void setShareTransform(bool value) {
+        share_transform = value;
+    }
+
+    /**
+     * Draw each instance at the finest level of detail of its mesh with at
+     * most one triangle per LOD_PIXELS_PER_TRIANGLE pixels of its projected
+     * bounding sphere. Meshes without levels of detail are always drawn in full.
+     */
+    void setLOD(bool value) {
+        lod = value;
+    }
+
+    /**
+     * Multi-sample anti-aliasing with 4 or 8 samples per pixel, 1 to turn
+     * it off. Only Simple Z-Buffer draws samples, shading them forward even
+     * in deferred mode.
+     */
+    void setSamples(int value) {
+        samples = value;
+        simpleZBuffer.setSamples(value);
+    }
+
+    /**
+     * Storage of depth tested per pixel and of the farthest depths of the
+     * hierarchical pyramids, quantized conservatively. The occluder buffer
+     * keeps floats.
+     */
+    void setDepthFormat(DepthFormat base, DepthFormat pyramid) {
+        depth_format = base;
+        pyramid_format = pyramid;
+        simpleZBuffer.depth.setFormat(base);
+        hierarchicalZBuffer.depth.setFormat(base, pyramid);
+        octreeZBuffer.depth.setFormat(base, pyramid);
+    }
+
+    // Returns the number of instances submitted.
+    int drawGrid(ZBufferAlgorithm algorithm,
+                 TriangleMesh const& mesh,
+                 std::vector<color8> const& colors,
+                 float4x4 const& proj,
+                 Camera const& camera,
+                 int c, int n,
+                 Image & image) {
+
+        auto view = lookAt(mesh.center + float3(0, 0, camera.z), mesh.center, float3(0, 1, 0));
+        auto rotation = rotateX(camera.rotate_x) * rotateY(camera.rotate_y);
+
+        std::vector<SceneInstance> instances;
+        for (int x = -c; x <= c; ++x) for (int y = -c; y <= c; ++y) for (int z = -1; z <= n - 2; ++z) {
+            instances.push_back({ 0, float3(x, y, z) });
+        }
+        return drawInstances(algorithm, { &mesh }, { &colors }, instances, proj * view * rotation, image);
+    }
+
+    /**
+     * Draws every instance of a scene, colors holds the triangle colors of
+     * each mesh. The scene is rotated around its center, which the camera
+     * looks at from z. Returns the number of instances submitted.
+     */
+    int drawScene(ZBufferAlgorithm algorithm,
+                  Scene const& scene,
+                  std::vector<std::vector<color8>> const& colors,
+                  float4x4 const& proj,
+                  Camera const& camera,
+                  Image & image) {
+
+        auto const& center = scene.center;
+        auto view = lookAt(center + float3(0, 0, camera.z), center, float3(0, 1, 0));
+        auto rotation = translate(center.x, center.y, center.z)
+                      * rotateX(camera.rotate_x) * rotateY(camera.rotate_y)
+                      * translate(-center.x, -center.y, -center.z);
+
+        std::vector<TriangleMesh const*> meshes;
+        std::vector<std::vector<color8> const*> mesh_colors;
+        for (size_t i = 0; i < scene.meshes.size(); ++i) {
+            meshes.push_back(&scene.meshes[i]);
+            mesh_colors.push_back(&colors[i]);
+        }
+        return drawInstances(algorithm, meshes, mesh_colors, scene.instances, proj * view * rotation, image);
+    }
+
+    // Depth of the last frame, rows from bottom to top, decoded to floats
+    // valid until the next call. Returns nullptr for Scanline Z-Buffer,
+    // which only keeps depth of the current scanline, and with multi-sample
+    // anti-aliasing, which keeps depth per sample.
+    float* depthBuffer(ZBufferAlgorithm algorithm) {
+        DepthLevel const* level = nullptr;
+        switch (algorithm) {
+        case ZBufferAlgorithm::SimpleZBuffer:
+            if (!simpleZBuffer.msaa) level = &simpleZBuffer.depth.level;
+            break;
+        case ZBufferAlgorithm::ScanlineZBuffer:
+            break;
+        case ZBufferAlgorithm::HierarchicalZBuffer:
+            level = &hierarchicalZBuffer.depth.mip[0];
+            break;
+        case ZBufferAlgorithm::OctreeZBuffer:
+        case ZBufferAlgorithm::OctreeZBufferFixed:
+            level = &octreeZBuffer.depth.mip[0];
+            break;
+        }
+        if (!level) return nullptr;
+        decoded_depth.resize(level->size);
+        for (int i = 0; i < level->size; ++i) decoded_depth[i] = level->at(i);
+        return decoded_depth.data();
+    }
+
+    VisibilityBuffer & visibilityBuffer(ZBufferAlgorithm algorithm) {
+        switch (algorithm) {
+        case ZBufferAlgorithm::SimpleZBuffer:
+            return simpleZBuffer.visibility;
+        case ZBufferAlgorithm::ScanlineZBuffer:
+            return scanlineZBuffer.visibility;
+        case ZBufferAlgorithm::HierarchicalZBuffer:
+            return hierarchicalZBuffer.visibility;
+        case ZBufferAlgorithm::OctreeZBuffer:
+        case ZBufferAlgorithm::OctreeZBufferFixed:
+            break;
+        }
+        return octreeZBuffer.visibility;
+    }
+
+    OverdrawBuffer & overdrawBuffer(ZBufferAlgorithm algorithm) {
+        switch (algorithm) {
+        case ZBufferAlgorithm::SimpleZBuffer:
+            return simpleZBuffer.overdraw;
+        case ZBufferAlgorithm::ScanlineZBuffer:
+            return scanlineZBuffer.overdraw;
+        case ZBufferAlgorithm::HierarchicalZBuffer:
+            return hierarchicalZBuffer.overdraw;
+        case ZBufferAlgorithm::OctreeZBuffer:
+        case ZBufferAlgorithm::OctreeZBufferFixed:
+            break;
+        }
+        return octreeZBuffer.overdraw;
+    }
+
+private:
+    bool two_phase = false;
+    std::vector<float> decoded_depth;
+    // Instances with pixels written in the last frame, for two-phase occlusion.
+    std::vector<char> last_visible;
+    ZBufferAlgorithm last_algorithm = ZBufferAlgorithm::SimpleZBuffer;
+
+    /**
+     * Draws the instances with the largest bounds on screen into the occluder
+     * buffer and marks the instances hidden behind them. Occluders are never
+     * hidden by themselves, their bounds are in front of their own depth.
+     */
+    void cullOccluded(ZBufferAlgorithm algorithm,
+                      std::vector<TriangleMesh const*> const& meshes,
+                      std::vector<SceneInstance> const& instances,
+                      std::vector<float4x4> const& mvps,
+                      std::vector<char> & occluded) {
+        STATS_BEGIN(occluder);
+        int count = mvps.size();
+        OcclusionQueries queries(occluderBuffer.depth.width, occluderBuffer.depth.height);
+        for (int id = 0; id < count; ++id) {
+            auto const& mesh = *meshes[instances[id].mesh];
+            queries.add(mesh.min, mesh.max, mvps[id]);
+        }
+
+        std::vector<int> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        auto area = [&](int i) {
+            return (queries.x_max[i] - queries.x_min[i] + 1) * (queries.y_max[i] - queries.y_min[i] + 1);
+        };
+        int occluders = std::min(count, OCCLUDER_INSTANCES);
+        std::partial_sort(order.begin(), order.begin() + occluders, order.end(),
+                          [&](int a, int b) { return area(a) > area(b); });
+
+        // Coverage follows the rasterizer of the algorithm, Scanline Z-Buffer
+        // always snaps to pixels and only Simple Z-Buffer does multi-sampling.
+        occluderBuffer.subpixel = subpixel && algorithm != ZBufferAlgorithm::ScanlineZBuffer;
+        occluderBuffer.msaa = algorithm == ZBufferAlgorithm::SimpleZBuffer ? simpleZBuffer.msaa.get() : nullptr;
+        occluderBuffer.clear();
+        auto & stage = occluderBuffer.vertex_stage;
+        for (int i = 0; i < occluders; ++i) {
+            auto const& instance = instances[order[i]];
+            setSharedTransform(stage, instance);
+            occluderBuffer.drawMesh(*meshes[instance.mesh], mvps[order[i]]);
+        }
+        stage.shared = nullptr;
+
+        occluderBuffer.depth.query(queries);
+        for (int id = 0; id < count; ++id) {
+            if (queries.visible(id)) continue;
+            occluded[id] = 1;
+            STATS_INC(meshes_occluded);
+        }
+        STATS_END(occluder);
+    }
+
+    // Vertices of each mesh transformed once per frame for all of its instances.
+    std::vector<SharedTransform> shared_transforms;
+
+    /**
+     * Draws instances of meshes, all transformed by mvp after their own
+     * translation. The index of an instance is its instance id.
+     */
+    int drawInstances(ZBufferAlgorithm algorithm,
+                      std::vector<TriangleMesh const*> const& base_meshes,
+                      std::vector<std::vector<color8> const*> const& base_colors,
+                      std::vector<SceneInstance> const& base_instances,
+                      float4x4 const& mvp,
+                      Image & image) {
+
+        clear(algorithm);
+
+        // With levels of detail, every level is drawn as a mesh of its own.
+        std::vector<TriangleMesh const*> level_meshes;
+        std::vector<std::vector<color8> const*> level_colors;
+        std::vector<SceneInstance> level_instances;
+        if (lod) selectLevels(base_meshes, base_colors, base_instances, mvp, level_meshes, level_colors, level_instances);
+        auto const& meshes = lod ? level_meshes : base_meshes;
+        auto const& colors = lod ? level_colors : base_colors;
+        auto const& instances = lod ? level_instances : base_instances;
+        submitted_triangles = 0;
+        for (auto const& instance : instances) submitted_triangles += meshes[instance.mesh]->indices.size();
+
+        if (share_transform) {
+            STATS_BEGIN(transform);
+            std::vector<char> used(meshes.size(), 0);
+            for (auto const& instance : instances) used[instance.mesh] = 1;
+            shared_transforms.resize(meshes.size());
+            for (size_t i = 0; i < meshes.size(); ++i) {
+                if (used[i]) shared_transforms[i].update(*meshes[i], mvp);
+            }
+            STATS_END(transform);
+        }
+
+        unsigned int count = instances.size();
+        std::vector<float4x4> mvps;
+        std::vector<std::vector<color8> const*> instance_colors;
+        for (auto const& instance : instances) {
+            auto const& t = instance.translation;
+            mvps.push_back(mvp * translate(t.x, t.y, t.z));
+            instance_colors.push_back(colors[instance.mesh]);
+        }
+
+        auto & stage = vertexStage(algorithm);
+        auto draw = [&](unsigned int id) {
+            auto const& instance = instances[id];
+            setSharedTransform(stage, instance);
+            return drawMesh(algorithm, *meshes[instance.mesh], *colors[instance.mesh], mvps[id], image, id);
+        };
+
+        std::vector<char> occluded(count, 0);
+        if (occluder_pass) cullOccluded(algorithm, meshes, instances, mvps, occluded);
+
+        auto pyramid = depthPyramid(algorithm);
+        if (!two_phase || !pyramid) {
+            for (unsigned int id = 0; id < count; ++id) {
+                if (occluded[id]) continue;
+                draw(id);
+            }
+            stage.shared = nullptr;
+            resolve(algorithm, instance_colors, image);
+            return count;
+        }
+
+        // Visibility of the last frame is only reused by the same algorithm and instances.
+        if (algorithm != last_algorithm || last_visible.size() != count) {
+            last_algorithm = algorithm;
+            last_visible.assign(count, 0);
+        }
+        std::vector<char> visible(count, 0);
+
+        // Phase 1, instances visible in the last frame are the occluders.
+        for (unsigned int id = 0; id < count; ++id) {
+            if (!last_visible[id] || occluded[id]) continue;
+            visible[id] = draw(id);
+        }
+
+        // Phase 2, the others are culled by their bounding sphere.
+        MeshletCuller culler;
+        culler.depth = pyramid;
+        for (unsigned int id = 0; id < count; ++id) {
+            if (last_visible[id] || occluded[id]) continue;
+            auto const& mesh = *meshes[instances[id].mesh];
+            auto center = (mesh.min + mesh.max) / 2;
+            auto extent = mesh.max - center;
+            culler.setup(mvps[id]);
+            if (culler.occluded(center, std::sqrt(extent.dot(extent)))) {
+                STATS_INC(meshes_occluded);
+                continue;
+            }
+            visible[id] = draw(id);
+        }
+        stage.shared = nullptr;
+
+        // Instances drawn early may be hidden by later ones, keep only those
+        // not occluded by the final pyramid as occluders of the next frame.
+        OcclusionQueries queries(width, height);
+        std::vector<unsigned int> drawn;
+        for (unsigned int id = 0; id < count; ++id) {
+            if (!visible[id]) continue;
+            auto const& mesh = *meshes[instances[id].mesh];
+            queries.add(mesh.min, mesh.max, mvps[id]);
+            drawn.push_back(id);
+        }
+        pyramid->query(queries);
+        for (size_t i = 0; i < drawn.size(); ++i) {
+            visible[drawn[i]] = queries.visible(i);
+        }
+        last_visible.swap(visible);
+
+        resolve(algorithm, instance_colors, image);
+        return count;
+    }
+
+    /**
+     * Lists the levels of detail of all meshes and points each instance to
+     * the level picked by the size of its bounding sphere on screen. All
+     * levels of a mesh share its colors, they are indexed by source triangle.
+     */
+    void selectLevels(std::vector<TriangleMesh const*> const& meshes,
+                      std::vector<std::vector<color8> const*> const& colors,
+                      std::vector<SceneInstance> const& instances,
+                      float4x4 const& mvp,
+                      std::vector<TriangleMesh const*> & level_meshes,
+                      std::vector<std::vector<color8> const*> & level_colors,
+                      std::vector<SceneInstance> & level_instances) const {
+        std::vector<int> first_level;
+        for (size_t i = 0; i < meshes.size(); ++i) {
+            first_level.push_back(level_meshes.size());
+            for (int l = 0; l < meshes[i]->levels(); ++l) {
+                level_meshes.push_back(&meshes[i]->level(l));
+                level_colors.push_back(colors[i]);
+            }
+        }
+
+        // Perspective divides by w, the length of the rows of mvp scale
+        // distances in the model to w and to screen height.
+        auto w_row = mvp.row(3);
+        auto y_row = mvp.row(1);
+        auto w_scale = std::sqrt(w_row.x * w_row.x + w_row.y * w_row.y + w_row.z * w_row.z);
+        auto y_scale = std::sqrt(y_row.x * y_row.x + y_row.y * y_row.y + y_row.z * y_row.z);
+        for (auto const& instance : instances) {
+            auto const& mesh = *meshes[instance.mesh];
+            auto center = (mesh.min + mesh.max) / 2;
+            auto extent = mesh.max - center;
+            auto radius = std::sqrt(extent.dot(extent));
+            auto w = w_row.dot(float4(center + instance.translation, 1.0f));
+
+            int l = 0;
+            // The full mesh is drawn when the camera is inside the sphere.
+            if (w > radius * w_scale) {
+                auto pixels = radius * y_scale / w * height * 0.5f;
+                auto area = PI() * pixels * pixels;
+                while (l + 1 < mesh.levels() && mesh.level(l).indices.size() * LOD_PIXELS_PER_TRIANGLE > area) ++l;
+            }
+            if (l > 0) STATS_INC(meshes_simplified);
+            level_instances.push_back({ first_level[instance.mesh] + l, instance.translation });
+        }
+    }
+
+    // Averages samples with multi-sample anti-aliasing, otherwise shades
+    // the visibility buffer in deferred mode.
+    void resolve(ZBufferAlgorithm algorithm,
+                 std::vector<std::vector<color8> const*> const& instance_colors,
+                 Image & image) {
+        if (algorithm == ZBufferAlgorithm::SimpleZBuffer && simpleZBuffer.msaa) {
+            simpleZBuffer.resolve(image);
+        }
+        else if (deferred) {
+            visibilityBuffer(algorithm).resolve(instance_colors, image);
+        }
+    }
+
+    void setSharedTransform(VertexStage & stage, SceneInstance const& instance) const {
+        if (!share_transform) return;
+        auto const& shared = shared_transforms[instance.mesh];
+        stage.shared = &shared;
+        stage.shared_offset = shared.offset(instance.translation);
+    }
+
+    bool drawMesh(ZBufferAlgorithm algorithm,
+                  TriangleMesh const& mesh,
+                  std::vector<color8> const& colors,
+                  float4x4 const& mvp,
+                  Image & image,
+                  unsigned int id) {
+        switch (algorithm) {
+        case ZBufferAlgorithm::SimpleZBuffer:
+            return simpleZBuffer.drawMesh(mesh, colors, mvp, image, id);
+        case ZBufferAlgorithm::ScanlineZBuffer:
+            return scanlineZBuffer.drawMesh(mesh, colors, mvp, image, id);
+        case ZBufferAlgorithm::HierarchicalZBuffer:
+            return hierarchicalZBuffer.drawMesh(mesh, colors, mvp, image, id);
+        case ZBufferAlgorithm::OctreeZBuffer:
+        case ZBufferAlgorithm::OctreeZBufferFixed:
+            return octreeZBuffer.drawMesh(mesh, colors, mvp, image, id);
+        }
+        return false;
+    }
+
+    VertexStage & vertexStage(ZBufferAlgorithm algorithm) {
+        switch (algorithm) {
+        case ZBufferAlgorithm::SimpleZBuffer:
+            return simpleZBuffer.vertex_stage;
+        case ZBufferAlgorithm::ScanlineZBuffer:
+            return scanlineZBuffer.vertex_stage;
+        case ZBufferAlgorithm::HierarchicalZBuffer:
+            return hierarchicalZBuffer.vertex_stage;
+        case ZBufferAlgorithm::OctreeZBuffer:
+        case ZBufferAlgorithm::OctreeZBufferFixed:
+            break;
+        }
+        return octreeZBuffer.vertex_stage;
+    }
+
+    HierarchicalZBuffer const* depthPyramid(ZBufferAlgorithm algorithm) const {
+        switch (algorithm) {
+        case ZBufferAlgorithm::SimpleZBuffer:
+        case ZBufferAlgorithm::ScanlineZBuffer:
+            return nullptr;
+        case ZBufferAlgorithm::HierarchicalZBuffer:
+            return &hierarchicalZBuffer.depth;
+        case ZBufferAlgorithm::OctreeZBuffer:
+        case ZBufferAlgorithm::OctreeZBufferFixed:
+            return &octreeZBuffer.depth;
+        }
+        return nullptr;
+    }
+
+    void clear(ZBufferAlgorithm algorithm) {
+        switch (algorithm) {
+        case ZBufferAlgorithm::SimpleZBuffer:
+            simpleZBuffer.clearDepth(); break;
+        case ZBufferAlgorithm::ScanlineZBuffer:
+            break;
+        case ZBufferAlgorithm::HierarchicalZBuffer:
+            hierarchicalZBuffer.clearDepth(); break;
+        case ZBufferAlgorithm::OctreeZBuffer:
+            octreeZBuffer.clearDepth(); break;
+        case ZBufferAlgorithm::OctreeZBufferFixed:
+            octreeZBuffer.clearDepth();
+            octreeZBuffer.fixed = true;
+            break;
+        }
+        if (write_visibility) visibilityBuffer(algorithm).clear();
+        if (count_overdraw) overdrawBuffer(algorithm).clear();
+    }
+};
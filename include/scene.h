@@ -0,0 +1,52 @@
+/**
+ * Meshes and their instances, loaded from a text file.
+ * How to use:
+ *  1. Write a scene file, mesh paths are relative to the scene file:
+ *      ```
+ *      # Comments start with '#'.
+ *      mesh spot.obj           # mesh 0
+ *      mesh bunny.obj          # mesh 1
+ *      instance 0 0 0 0        # mesh index and translation
+ *      instance 1 1.5 0 0
+ *      grid 1 2 3              # 5 * 5 * 3 instances, same as '-c 5 3'
+ *      ```
+ *  2. Load it and draw all instances every frame:
+ *      ```
+ *      Scene scene("scenes/sample.scene");
+ *      renderer.drawScene(algorithm, scene, colors, proj, camera, image);
+ *      ```
+ * Instances are translated copies of meshes, so the vertices of each mesh
+ * are only transformed once per frame for all of its instances.
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include "vector.h"
+#include "mesh.h"
+
+// Maximum number of instances added by one grid line.
+#define SCENE_MAX_GRID_INSTANCES 100000
+
+struct SceneInstance {
+    int mesh;           // index into meshes
+    float3 translation;
+};
+
+struct Scene {
+    std::vector<TriangleMesh> meshes;
+    std::vector<SceneInstance> instances;
+    // Bounding box of all instances.
+    float3 center;
+    float3 min;
+    float3 max;
+
+    Scene() = delete;
+    // Meshes are loaded as TriangleMesh(path, reorder, lod).
+    Scene(std::string const& path, bool reorder = true, bool lod = false);
+
+    // Add (2 * c + 1) * (2 * c + 1) * n instances, as drawn by Renderer::drawGrid.
+    void addGrid(int mesh, int c, int n);
+    void updateBounds();
+};
@@ -0,0 +1,108 @@
+/**
+ * Per-frame counters and stage timers shared by all rasterizers.
+ * Everything is compiled out unless ZB_ENABLE_STATS is defined: without
+ * it the macros below expand to nothing.
+ * How to use:
+ *  1. Build with ZB_ENABLE_STATS defined:
+ *      ```
+ *      make STATS=1
+ *      ```
+ *  2. Reset at the beginning of a frame and report at the end:
+ *      ```
+ *      STATS_RESET();
+ *      rasterizer.drawMesh(mesh, colors, mvp, image);
+ *      STATS_REPORT(std::cout);
+ *      ```
+ *  3. Count and time in the rasterizers:
+ *      ```
+ *      STATS_BEGIN(transform);
+ *      ...
+ *      STATS_END(transform);
+ *      STATS_INC(pixels_tested);
+ *      ```
+ */
+
+#pragma once
+
+#include <ostream>
+#include "timer.h"
+
+struct RenderStats {
+    long long meshes_submitted = 0;
+    long long meshes_culled = 0;            // whole mesh outside the view volume
+    long long meshes_occluded = 0;          // rejected by two-phase or occluder culling
+    long long meshes_simplified = 0;        // drawn at a coarser level of detail
+    long long triangles_submitted = 0;
+    long long triangles_backface_culled = 0;
+    long long triangles_frustum_culled = 0;
+    long long triangles_degenerate = 0;     // zero area after screen mapping
+    long long meshlets_tested = 0;
+    long long meshlets_frustum_culled = 0;
+    long long meshlets_backface_culled = 0; // normal cone facing away
+    long long meshlets_occluded = 0;        // behind the depth pyramid
+    long long hiz_tests = 0;                // block tests against the depth pyramid
+    long long hiz_rejected = 0;
+    long long octree_nodes_visited = 0;
+    long long octree_nodes_culled = 0;
+    long long pixels_tested = 0;            // depth tests
+    long long pixels_written = 0;           // depth tests passed
+    long long msaa_tiles_plane = 0;         // multi-sample tiles stored as one depth plane
+    long long msaa_tiles_expanded = 0;      // multi-sample tiles stored per sample
+
+    // Seconds spent in each stage.
+    double transform_time = 0.0;    // vertex transform and mesh culling
+    double build_time = 0.0;        // octree or sorted edge table construction
+    double raster_time = 0.0;       // triangle setup, traversal and depth test
+    double occluder_time = 0.0;     // low resolution occluder pass and its tests
+
+    void reset() {
+        *this = RenderStats();
+    }
+
+    void report(std::ostream & out) const {
+        out << "Stages: transform " << transform_time * 1000 << "ms"
+            << ", build " << build_time * 1000 << "ms"
+            << ", raster " << raster_time * 1000 << "ms"
+            << ", occluder " << occluder_time * 1000 << "ms\n";
+        out << "Meshes: " << meshes_submitted << " (culled " << meshes_culled
+            << ", occluded " << meshes_occluded
+            << ", simplified " << meshes_simplified << ")\n";
+        out << "Triangles: " << triangles_submitted
+            << " (back-face " << triangles_backface_culled
+            << ", frustum " << triangles_frustum_culled
+            << ", degenerate " << triangles_degenerate << ")\n";
+        out << "Meshlets: " << meshlets_tested
+            << " (frustum " << meshlets_frustum_culled
+            << ", back-face " << meshlets_backface_culled
+            << ", occluded " << meshlets_occluded << ")\n";
+        out << "Hi-Z tests: " << hiz_tests << " (rejected " << hiz_rejected << ")\n";
+        out << "Octree nodes: " << octree_nodes_visited << " (culled " << octree_nodes_culled << ")\n";
+        out << "Pixels: tested " << pixels_tested << ", written " << pixels_written << "\n";
+        out << "MSAA tiles: plane " << msaa_tiles_plane << ", expanded " << msaa_tiles_expanded << "\n";
+    }
+};
+
+#ifdef ZB_ENABLE_STATS
+
+inline RenderStats render_stats;
+
+#define STATS_ADD(counter, n)   (render_stats.counter += (n))
+#define STATS_INC(counter)      (++render_stats.counter)
+#define STATS_BEGIN(stage)      Timer stats_timer_##stage
+#define STATS_END(stage) do {                                   \
+    stats_timer_##stage.update();                               \
+    render_stats.stage##_time += stats_timer_##stage.deltaTime(); \
+} while(0)
+#define STATS_RESET()           render_stats.reset()
+#define STATS_REPORT(out)       render_stats.report(out)
+
+#else
+
+#define STATS_ADD(counter, n)   ((void)0)
+#define STATS_INC(counter)      ((void)0)
+#define STATS_BEGIN(stage)      ((void)0)
+#define STATS_END(stage)        ((void)0)
+#define STATS_RESET()           ((void)0)
+#define STATS_REPORT(out)       ((void)0)
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * Fixed-point triangle setup and traversal with subpixel precision.
+ * Screen positions are rounded to 24.8 fixed point instead of being snapped
+ * to whole pixels, samples are taken at pixel centers and edge functions are
+ * evaluated and stepped with integers.
+ * Pixels exactly on an edge are covered only if the edge is a top or left
+ * edge, so pixels on an edge shared by two triangles are drawn exactly once.
+ * How to use:
+ *  1. Setup with screen space vertices, z holding the reciprocal of depth:
+ *      ```
+ *      FixedTriangle t;
+ *      if (!t.setup(v0, v1, v2)) continue; // covers no pixel center
+ *      ```
+ *  2. Visit covered pixels inside a (clamped) pixel rectangle:
+ *      ```
+ *      t.rasterize(x_min, x_max, y_min, y_max, [&](int x, int y, float z) {
+ *          ...                              // z is the interpolated depth
+ *      });
+ *      ```
+ */
+
+#pragma once
+
+#include <cmath>
+#include <utility>
+#include "vector.h"
+
+// Fractional bits of fixed-point screen positions.
+#define SUBPIXEL_BITS 8
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+#define SUBPIXEL_HALF (SUBPIXEL_ONE / 2)
+
+inline int toFixed(float x) {
+    return (int)std::lround(x * SUBPIXEL_ONE);
+}
+
+struct FixedTriangle {
+    int x[3], y[3];     // 24.8 fixed-point screen position
+    float z[3];         // reciprocal of depth
+    long long area;     // twice the area, in squared subpixels
+    // Edge e is opposite to vertex e, E(x, y) = a * x + b * y + c at pixel
+    // (x, y) is positive inside. The top-left bias is folded into c.
+    long long a[3], b[3], c[3];
+    // Pixels whose centers lie in the bounding box, not clamped to the screen.
+    int x_min, x_max, y_min, y_max;
+
+    /**
+     * Returns false if the triangle has no area or no pixel center inside
+     * its bounding box. Both windings are accepted. Edges are set up in the
+     * second case, samples away from pixel centers may still be covered.
+     */
+    bool setup(float3 const& v0, float3 const& v1, float3 const& v2) {
+        float3 const* v[3] = { &v0, &v1, &v2 };
+        for (int i = 0; i < 3; ++i) {
+            x[i] = toFixed(v[i]->x);
+            y[i] = toFixed(v[i]->y);
+            z[i] = v[i]->z;
+        }
+
+        area = (long long)(x[1] - x[0]) * (y[2] - y[0])
+             - (long long)(y[1] - y[0]) * (x[2] - x[0]);
+        if (area == 0) return false;
+        // Make the winding counter-clockwise so that inside is positive.
+        if (area < 0) {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(z[1], z[2]);
+            area = -area;
+        }
+
+        for (int e = 0; e < 3; ++e) {
+            auto i = (e + 1) % 3;
+            auto j = (e + 2) % 3;
+            long long dx = x[j] - x[i];
+            long long dy = y[j] - y[i];
+            // E(p) = dx * (p.y - y[i]) - dy * (p.x - x[i]) with p at the pixel center.
+            a[e] = -dy * SUBPIXEL_ONE;
+            b[e] = dx * SUBPIXEL_ONE;
+            c[e] = dx * (SUBPIXEL_HALF - y[i]) - dy * (SUBPIXEL_HALF - x[i]);
+            // Walking counter-clockwise with y up, left edges go down and
+            // top edges go left. Other edges exclude pixels exactly on them.
+            bool top_left = dy < 0 || (dy == 0 && dx < 0);
+            if (!top_left) c[e] -= 1;
+        }
+
+        // First and last pixel centers inside the bounding box, which is
+        // empty for triangles between pixel centers.
+        auto ceilCenter = [](int v) { return (v - SUBPIXEL_HALF + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS; };
+        auto floorCenter = [](int v) { return (v - SUBPIXEL_HALF) >> SUBPIXEL_BITS; };
+        x_min = ceilCenter(std::min(x[0], std::min(x[1], x[2])));
+        x_max = floorCenter(std::max(x[0], std::max(x[1], x[2])));
+        y_min = ceilCenter(std::min(y[0], std::min(y[1], y[2])));
+        y_max = floorCenter(std::max(y[0], std::max(y[1], y[2])));
+        return x_min <= x_max && y_min <= y_max;
+    }
+
+    long long edge(int e, int px, int py) const {
+        return a[e] * px + b[e] * py + c[e];
+    }
+
+    // Change of edge e from a pixel center to a point (dx, dy) subpixels away,
+    // exact since a and b are multiples of SUBPIXEL_ONE.
+    long long offset(int e, int dx, int dy) const {
+        return (a[e] * dx + b[e] * dy) >> SUBPIXEL_BITS;
+    }
+
+    // Calls f(x, y, z) for every covered pixel in the given rectangle.
+    template<typename F>
+    void rasterize(int x0, int x1, int y0, int y1, F && f) const {
+        auto inv_area = 1.0f / area;
+        auto row0 = edge(0, x0, y0);
+        auto row1 = edge(1, x0, y0);
+        auto row2 = edge(2, x0, y0);
+        for (int py = y0; py <= y1; ++py) {
+            auto e0 = row0;
+            auto e1 = row1;
+            auto e2 = row2;
+            for (int px = x0; px <= x1; ++px) {
+                if ((e0 | e1 | e2) >= 0) {
+                    auto denom = (e0 * z[0] + e1 * z[1] + e2 * z[2]) * inv_area;
+                    f(px, py, 1.0f / denom);
+                }
+                e0 += a[0];
+                e1 += a[1];
+                e2 += a[2];
+            }
+            row0 += b[0];
+            row1 += b[1];
+            row2 += b[2];
+        }
+    }
+};
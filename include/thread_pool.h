@@ -0,0 +1,106 @@
+/**
+ * Fixed set of threads that run the tasks of one job at a time.
+ * How to use:
+ *  1. Create with the number of threads, the thread calling run() is one of them:
+ *      ```
+ *      ThreadPool pool(std::thread::hardware_concurrency());
+ *      ```
+ *  2. Run task_num tasks and wait for all of them, worker is in [0, pool.size())
+ *     and no two tasks run on the same worker at the same time:
+ *      ```
+ *      pool.run(task_num, [&](int task, int worker) { ... });
+ *      ```
+ */
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+struct ThreadPool {
+    ThreadPool(int thread_num) {
+        for (int i = 1; i < thread_num; ++i) {
+            workers.emplace_back(&ThreadPool::work, this, i);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        job_ready.notify_all();
+        for (auto & worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return workers.size() + 1; }
+
+    void run(int task_num, std::function<void(int, int)> const& task) {
+        if (workers.empty() || task_num <= 1) {
+            for (int i = 0; i < task_num; ++i) task(i, 0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &task;
+            tasks = task_num;
+            next = 0;
+            pending = task_num;
+            ++generation;
+        }
+        job_ready.notify_all();
+        execute(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        job_done.wait(lock, [this]() { return pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+    std::function<void(int, int)> const* job = nullptr;
+    int tasks = 0;
+    int next = 0;       // next task to start
+    int pending = 0;    // tasks not finished
+    unsigned int generation = 0;
+    bool stop = false;
+
+    // Run tasks of the current job until none is left to start.
+    void execute(int worker) {
+        while (true) {
+            int task;
+            std::function<void(int, int)> const* current;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (next >= tasks) return;
+                task = next++;
+                current = job;
+            }
+            (*current)(task, worker);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) job_done.notify_all();
+        }
+    }
+
+    void work(int worker) {
+        unsigned int seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_ready.wait(lock, [&]() { return stop || generation != seen; });
+                if (stop) return;
+                seen = generation;
+            }
+            execute(worker);
+        }
+    }
+};
@@ -295,7 +295,7 @@ struct Vector4 {
         };
     }
 
-    T dot(Vector4 const& other) {
+    T dot(Vector4 const& other) const {
         return x * other.x + y * other.y + z * other.z + w * other.w;
     }
 };
@@ -6,56 +6,110 @@
 #include "utils.h"
 #include "mesh.h"
 #include "image.h"
+#include "stats.h"
+#include "clipping.h"
+#include "subpixel.h"
+
+// Pyramid level at which coarse-to-fine traversal stops subdividing
+// and falls back to per-pixel depth tests.
+#define HIZ_LEAF_LEVEL 2
 
 struct ZBHierarchical {
     int width;
     int height;
     HierarchicalZBuffer depth;
+    VisibilityBuffer visibility;
+    OverdrawBuffer overdraw;
+    // Write (instance, triangle) ids of visible pixels to visibility.
+    bool write_visibility = false;
+    // Depth prepass, skip colors and shade later by visibility.resolve(),
+    // requires write_visibility.
+    bool deferred = false;
+    // Count depth tests and writes of each pixel in overdraw.
+    bool count_overdraw = false;
+    // Rasterize 24.8 fixed-point positions with a top-left fill rule
+    // instead of snapping vertices to pixels.
+    bool subpixel = false;
+    // Cull whole meshlets by frustum, normal cone and depth before
+    // transforming their vertices.
+    bool cull_meshlets = true;
+    // Set when a pixel of the last mesh drawn passed the depth test.
+    bool mesh_visible = false;
+    // Transformed and clipped triangles of the current mesh.
+    VertexStage vertex_stage;
+
+    // Screen space triangle prepared for coarse-to-fine traversal.
+    struct Triangle {
+        float3 v[3];  // screen position with z replaced by 1 / z
+        float area;
+        float z_min;  // nearest depth of the triangle
+        int x_min, x_max, y_min, y_max;
+        int id;
+        unsigned int instance_id;
+        FixedTriangle fixed;  // only set up in subpixel mode
+    };
 
     ZBHierarchical(int w, int h)
         : width(w)
         , height(h)
-        , depth(w, h) {}
+        , depth(w, h)
+        , visibility(w, h)
+        , overdraw(w, h) {
+        vertex_stage.culler.depth = &depth;
+    }
 
     void clearDepth() {
         depth.clear(1.0f);
     }
 
-    void drawMesh(TriangleMesh const& mesh,
-                  std::vector<colorf> const& colors,
+    void clearVisibility() {
+        visibility.clear();
+    }
+
+    void clearOverdraw() {
+        overdraw.clear();
+    }
+
+    // Returns true if any pixel of the mesh passed the depth test.
+    bool drawMesh(TriangleMesh const& mesh,
+                  std::vector<color8> const& colors,
                   float4x4 const& mvp,
-                  Image & image) {
+                  Image & image,
+                  unsigned int instance_id = 0) {
         
-        std::vector<float3> ndc;
-        float3 min = float3(std::numeric_limits<float>::max());
-        float3 max = float3(std::numeric_limits<float>::min());
-        for (int i = 0; i < mesh.vertices.size(); ++i) {
-            auto v = float4(mesh.vertices[i], 1.0f);
-            v = mvp * v;
-            v.w = 1 / v.w;
-            v.x *= v.w;
-            v.y *= v.w;
-            v.z *= v.w;
-            min = float3::min(min, v);
-            max = float3::max(max, v);
-            ndc.push_back(float3(v));
-        }
+        mesh_visible = false;
+        STATS_INC(meshes_submitted);
+        STATS_ADD(triangles_submitted, mesh.indices.size());
+        STATS_BEGIN(transform);
+        auto visible = vertex_stage.process(mesh, mvp, cull_meshlets);
+        STATS_END(transform);
 
         // Cull mesh if out of screen.
-        if (min.x > 1 || max.x < -1
-         || min.y > 1 || max.y < -1 
-         || min.z > 1 || max.z <  0 ) return;
+        if (!visible) {
+            STATS_INC(meshes_culled);
+            return false;
+        }
 
-        for (int i = 0; i < mesh.indices.size(); ++i) {
-            auto v0 = ndc[mesh.indices[i][0]];
-            auto v1 = ndc[mesh.indices[i][1]];
-            auto v2 = ndc[mesh.indices[i][2]];
+        STATS_BEGIN(raster);
+        auto const& ndc = vertex_stage.ndc;
+        for (auto const& triangle : vertex_stage.triangles) {
+            auto v0 = ndc[triangle.v[0]];
+            auto v1 = ndc[triangle.v[1]];
+            auto v2 = ndc[triangle.v[2]];
 
             // Back-face culling.
             auto e01 = v1 - v0;
             auto e02 = v2 - v0;
             auto N = e01.cross(e02);
-            if (N.z < 0) continue;
+            if (N.z < 0) {
+                STATS_INC(triangles_backface_culled);
+                continue;
+            }
+
+            if (subpixel) {
+                drawTriangleSubpixel(v0, v1, v2, triangle.id, instance_id, colors, image);
+                continue;
+            }
 
             // Screen mapping.
             v0.x = ftoi((v0.x * 0.5f + 0.5f) * width);
@@ -68,75 +122,222 @@ struct ZBHierarchical {
             auto min = float3::min(v0, float3::min(v1, v2));
             auto max = float3::max(v0, float3::max(v1, v2));
 
-            auto x_min = clamp(ftoi(min.x), 0, width - 1);
-            auto x_max = clamp(ftoi(max.x), 0, width - 1);
-            auto y_min = clamp(ftoi(min.y), 0, height - 1);
-            auto y_max = clamp(ftoi(max.y), 0, height - 1);
+            // Cull triangle if out of screen, before the bounding box is clamped.
+            if (max.x < 0 || min.x > width - 1
+             || max.y < 0 || min.y > height - 1) {
+                STATS_INC(triangles_frustum_culled);
+                continue;
+            }
 
-            // Cull triangle if out of screen.
-            if (x_min > width  || x_max < 0
-             || y_min > height || y_max < 0) continue;
+            // Vertices are snapped to samples, so sub-pixel triangles have no area.
+            auto area = edgeFunction2D(v0, v1, v2);
+            if (area == 0) {
+                STATS_INC(triangles_degenerate);
+                continue;
+            }
 
             // Perspective-correct interpolation.
             v0.z = 1 / v0.z;
             v1.z = 1 / v1.z;
             v2.z = 1 / v2.z;
 
-            auto area = edgeFunction2D(v0, v1, v2);
-            if (area == 0) continue;
+            // A triangle whose bounding box spans 2x2 samples covers exactly
+            // its three vertices, test them without the pyramid and edge functions.
+            if (max.x - min.x == 1 && max.y - min.y == 1) {
+                drawVertex(v0, triangle.id, instance_id, colors, image);
+                drawVertex(v1, triangle.id, instance_id, colors, image);
+                drawVertex(v2, triangle.id, instance_id, colors, image);
+                continue;
+            }
 
-            auto level = getMinBoundingLevel(x_min, x_max, y_min, y_max);
-            if (min.z > depth.at((x_min + x_max) / 2, (y_min + y_max) / 2, level)) continue;
+            auto x_min = clamp(ftoi(min.x), 0, width - 1);
+            auto x_max = clamp(ftoi(max.x), 0, width - 1);
+            auto y_min = clamp(ftoi(min.y), 0, height - 1);
+            auto y_max = clamp(ftoi(max.y), 0, height - 1);
 
-            for (int x = x_min; x <= x_max; ++x) {
-                for (int y = y_min; y <= y_max; ++y) {
-                    auto pos = float3(x, y, 1);
-                    
-                    float w0, w1, w2;
-                    if (outsideTest2D(v0, v1, v2, pos, &w0, &w1, &w2)) continue;
+            Triangle t;
+            t.v[0] = v0;
+            t.v[1] = v1;
+            t.v[2] = v2;
+            t.area = area;
+            // Use the reciprocals so that the bound matches per-pixel depth at the vertices.
+            t.z_min = 1.0f / std::max(v0.z, std::max(v1.z, v2.z));
+            t.x_min = x_min;
+            t.x_max = x_max;
+            t.y_min = y_min;
+            t.y_max = y_max;
+            t.id = triangle.id;
+            t.instance_id = instance_id;
 
-                    w0 /= area;
-                    w1 /= area;
-                    w2 /= area;
+            drawTriangle(t, colors, image);
+        }
+        STATS_END(raster);
 
-                    auto denom = (w0 * v0.z + w1 * v1.z + w2 * v2.z);
-                    pos.z = 1.0f / denom;
+        return mesh_visible;
+    }
 
-                    if (pos.z < 0 || pos.z > 1) continue;
+    // Vertices are in NDC.
+    void drawTriangleSubpixel(float3 v0, float3 v1, float3 v2, int id, unsigned int instance_id,
+                              std::vector<color8> const& colors, Image & image) {
+        // Screen mapping without snapping.
+        v0 = float3((v0.x * 0.5f + 0.5f) * width, (v0.y * 0.5f + 0.5f) * height, 1 / v0.z);
+        v1 = float3((v1.x * 0.5f + 0.5f) * width, (v1.y * 0.5f + 0.5f) * height, 1 / v1.z);
+        v2 = float3((v2.x * 0.5f + 0.5f) * width, (v2.y * 0.5f + 0.5f) * height, 1 / v2.z);
 
-                    if (pos.z > depth.at(x, y, 0)) continue;
-                    
-                    depth.write(x, y, pos.z);
-                    image.setPixel(x, y, colors[i]);
-                }
+        Triangle t;
+        if (!t.fixed.setup(v0, v1, v2)) {
+            STATS_INC(triangles_degenerate);
+            return;
+        }
+
+        // Cull triangle if out of screen.
+        if (t.fixed.x_max < 0 || t.fixed.x_min > width - 1
+         || t.fixed.y_max < 0 || t.fixed.y_min > height - 1) {
+            STATS_INC(triangles_frustum_culled);
+            return;
+        }
+
+        t.z_min = 1.0f / std::max(v0.z, std::max(v1.z, v2.z));
+        t.x_min = std::max(t.fixed.x_min, 0);
+        t.x_max = std::min(t.fixed.x_max, width - 1);
+        t.y_min = std::max(t.fixed.y_min, 0);
+        t.y_max = std::min(t.fixed.y_max, height - 1);
+        t.id = id;
+        t.instance_id = instance_id;
+
+        drawTriangle(t, colors, image);
+    }
+
+    void drawTriangle(Triangle const& t,
+                      std::vector<color8> const& colors,
+                      Image & image) {
+        // Descend the pyramid from the finest level whose blocks are larger than the
+        // triangle's bounding box, so that at most 2x2 blocks need to be visited.
+        auto level = depth.startLevel(t.x_max - t.x_min, t.y_max - t.y_min);
+        auto w = width / depth.mip_w[level];
+        auto h = height / depth.mip_h[level];
+        for (int y = t.y_min & ~(h - 1); y <= t.y_max; y += h) {
+            for (int x = t.x_min & ~(w - 1); x <= t.x_max; x += w) {
+                drawBlock(t, x, y, level, colors, image);
             }
         }
     }
 
-public:
-    int getMinBoundingLevel(int x_min, int x_max, int y_min, int y_max) {
-        auto x = (x_min + x_max) / 2;
-        auto y = (y_min + y_max) / 2;
-
-        auto x_bound_min = 0;
-        auto x_bound_max = width - 1;
-        auto y_bound_min = 0;
-        auto y_bound_max = height - 1;
-
-        auto level = depth.maxLevel();
-        while (level > 0
-            && x_bound_min <= x_min && x_bound_max >= x_max
-            && y_bound_min <= y_min && y_bound_max >= y_max) {
-            --level;
-            
-            auto w = width / depth.mip_w[level];
-            auto h = height / depth.mip_h[level];
-            x_bound_min = x & ~(w - 1);
-            x_bound_max = (x + w - 1) & ~(w - 1);
-            y_bound_min = y & ~(h - 1);
-            y_bound_max = (y + h - 1) & ~(h - 1);
+    /**
+     * Rasterize the part of the triangle inside the block at [x, y] of the given level.
+     * - A block is rejected when the triangle's nearest depth is behind the farthest depth
+     *   stored for the block, or when all of its corners are outside one of the edges.
+     * - Otherwise it is split into its four children down to HIZ_LEAF_LEVEL, where the
+     *   remaining pixels are depth-tested one by one.
+     */
+    void drawBlock(Triangle const& t,
+                   int x, int y, int level,
+                   std::vector<color8> const& colors,
+                   Image & image) {
+
+        STATS_INC(hiz_tests);
+        if (t.z_min > depth.at(x, y, level)) {
+            STATS_INC(hiz_rejected);
+            return;
+        }
+
+        auto w = width / depth.mip_w[level];
+        auto h = height / depth.mip_h[level];
+        auto x0 = std::max(x, t.x_min);
+        auto x1 = std::min(x + w - 1, t.x_max);
+        auto y0 = std::max(y, t.y_min);
+        auto y1 = std::min(y + h - 1, t.y_max);
+        if (x0 > x1 || y0 > y1) return;
+
+        if (level > HIZ_LEAF_LEVEL) {
+            // Edge functions are linear, so a block lies outside an edge
+            // if all of its corners do.
+            if (subpixel) {
+                for (int e = 0; e < 3; ++e) {
+                    if (t.fixed.edge(e, x0, y0) < 0 && t.fixed.edge(e, x1, y0) < 0
+                     && t.fixed.edge(e, x0, y1) < 0 && t.fixed.edge(e, x1, y1) < 0) return;
+                }
+            }
+            else {
+                auto sign = t.area > 0 ? 1.0f : -1.0f;
+                float3 const corners[4] = {
+                    float3(x0, y0, 1), float3(x1, y0, 1),
+                    float3(x0, y1, 1), float3(x1, y1, 1),
+                };
+                for (int e = 0; e < 3; ++e) {
+                    auto const& a = t.v[(e + 1) % 3];
+                    auto const& b = t.v[(e + 2) % 3];
+                    bool outside = true;
+                    for (int c = 0; c < 4 && outside; ++c) {
+                        outside = edgeFunction2D(a, b, corners[c]) * sign < 0;
+                    }
+                    if (outside) return;
+                }
+            }
+
+            auto cw = width / depth.mip_w[level - 1];
+            auto ch = height / depth.mip_h[level - 1];
+            for (int cy = y; cy < y + h; cy += ch) {
+                for (int cx = x; cx < x + w; cx += cw) {
+                    drawBlock(t, cx, cy, level - 1, colors, image);
+                }
+            }
+            return;
+        }
+
+        if (subpixel) {
+            t.fixed.rasterize(x0, x1, y0, y1, [&](int px, int py, float z) {
+                drawPixel(px, py, z, t.id, t.instance_id, colors, image);
+            });
+            return;
         }
-        return level;
+
+        auto const& v0 = t.v[0];
+        auto const& v1 = t.v[1];
+        auto const& v2 = t.v[2];
+        for (int py = y0; py <= y1; ++py) {
+            for (int px = x0; px <= x1; ++px) {
+                auto pos = float3(px, py, 1);
+
+                float w0, w1, w2;
+                if (outsideTest2D(v0, v1, v2, pos, &w0, &w1, &w2)) continue;
+
+                w0 /= t.area;
+                w1 /= t.area;
+                w2 /= t.area;
+
+                auto denom = (w0 * v0.z + w1 * v1.z + w2 * v2.z);
+                pos.z = 1.0f / denom;
+
+                drawPixel(px, py, pos.z, t.id, t.instance_id, colors, image);
+            }
+        }
+    }
+
+    // Depth test and write a sample covered by triangle id.
+    void drawPixel(int x, int y, float z, int id, unsigned int instance_id,
+                   std::vector<color8> const& colors, Image & image) {
+        if (z < 0 || z > 1) return;
+
+        STATS_INC(pixels_tested);
+        if (count_overdraw) overdraw.test(x, y);
+        if (z > depth.at(x, y, 0)) return;
+
+        STATS_INC(pixels_written);
+        mesh_visible = true;
+        if (count_overdraw) overdraw.write(x, y);
+        depth.write(x, y, z);
+        if (write_visibility) visibility.write(x, y, VisibilityBuffer::encode(instance_id, id));
+        if (!deferred) image.writePixel(x, y, colors[id]);
+    }
+
+    // Vertex v is in screen space with the reciprocal of depth in z.
+    void drawVertex(float3 const& v, int id, unsigned int instance_id,
+                    std::vector<color8> const& colors, Image & image) {
+        int x = v.x;
+        int y = v.y;
+        if (x < 0 || x >= width || y < 0 || y >= height) return;
+        drawPixel(x, y, 1.0f / v.z, id, instance_id, colors, image);
     }
 
 };
\ No newline at end of file
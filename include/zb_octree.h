@@ -8,56 +8,88 @@
 #include "image.h"
 #include "octree.h"
 #include "timer.h"
+#include "stats.h"
+#include "clipping.h"
+#include "subpixel.h"
 
 struct ZBOctree {
     int width;
     int height;
     HierarchicalZBuffer depth;
+    VisibilityBuffer visibility;
+    OverdrawBuffer overdraw;
     Octree* octree;
     std::vector<Octree*> octree_cache;
     bool fixed = false;
+    // Write (instance, triangle) ids of visible pixels to visibility.
+    bool write_visibility = false;
+    // Depth prepass, skip colors and shade later by visibility.resolve(),
+    // requires write_visibility.
+    bool deferred = false;
+    // Count depth tests and writes of each pixel in overdraw.
+    bool count_overdraw = false;
+    // Rasterize 24.8 fixed-point positions with a top-left fill rule
+    // instead of snapping vertices to pixels.
+    bool subpixel = false;
+    // Cull whole meshlets by frustum, normal cone and depth before
+    // transforming their vertices.
+    bool cull_meshlets = true;
+    // Set when a pixel of the last mesh drawn passed the depth test.
+    bool mesh_visible = false;
+    // Transformed and clipped triangles of the current mesh.
+    VertexStage vertex_stage;
 
     ZBOctree(int w, int h)
         : width(w)
         , height(h)
         , depth(w, h)
-        , octree(nullptr) {}
+        , visibility(w, h)
+        , overdraw(w, h)
+        , octree(nullptr) {
+        vertex_stage.culler.depth = &depth;
+    }
 
     ~ZBOctree() {
-        if (octree) delete octree;
+        // In fixed mode octree is owned by octree_cache.
+        for (auto tree : octree_cache) delete tree;
+        if (octree && !fixed) delete octree;
     }
 
     void clearDepth() {
         depth.clear(1.0f);
     }
+
+    void clearVisibility() {
+        visibility.clear();
+    }
+
+    void clearOverdraw() {
+        overdraw.clear();
+    }
     
-    void drawMesh(TriangleMesh const& mesh,
-                  std::vector<colorf> const& colors,
+    // Returns true if any pixel of the mesh passed the depth test.
+    bool drawMesh(TriangleMesh const& mesh,
+                  std::vector<color8> const& colors,
                   float4x4 const& mvp,
                   Image & image,
                   unsigned int transform_id = 0,
                   bool display_octree = false,
                   colorf const& octree_color = colorf(1.0f)) {
         
-        std::vector<float3> ndc;
-        float3 min = float3(std::numeric_limits<float>::max());
-        float3 max = float3(std::numeric_limits<float>::min());
-        for (int i = 0; i < mesh.vertices.size(); ++i) {
-            auto v = float4(mesh.vertices[i], 1.0f);
-            v = mvp * v;
-            v.w = 1 / v.w;
-            v.x *= v.w;
-            v.y *= v.w;
-            v.z *= v.w;
-            min = float3::min(min, v);
-            max = float3::max(max, v);
-            ndc.push_back(float3(v));
-        }
+        mesh_visible = false;
+        STATS_INC(meshes_submitted);
+        STATS_ADD(triangles_submitted, mesh.indices.size());
+        STATS_BEGIN(transform);
+        // Octrees cached in fixed mode are reused from other views, so they
+        // must contain every triangle.
+        auto visible = vertex_stage.process(mesh, mvp, cull_meshlets && !fixed);
+        STATS_END(transform);
 
         // Cull mesh if out of screen.
-        if (min.x > 1 || max.x < -1
-         || min.y > 1 || max.y < -1 
-         || min.z > 1 || max.z <  0 ) return;
+        if (!visible) {
+            STATS_INC(meshes_culled);
+            return false;
+        }
 
 
         if (octree && !fixed) {
@@ -74,13 +106,17 @@ struct ZBOctree {
             }
         }
 
+        STATS_BEGIN(build);
         if (!octree) {
+            auto const& ndc = vertex_stage.ndc;
+            auto const& min = vertex_stage.min;
+            auto const& max = vertex_stage.max;
             octree = new Octree((max + min) / 2, (max - min) / 2);
-            for (int i = 0; i < mesh.indices.size(); ++i) {
-                auto v0 = ndc[mesh.indices[i][0]];
-                auto v1 = ndc[mesh.indices[i][1]];
-                auto v2 = ndc[mesh.indices[i][2]];
-                auto d = new OctreeData(v0, v1, v2, i);
+            for (auto const& triangle : vertex_stage.triangles) {
+                auto v0 = ndc[triangle.v[0]];
+                auto v1 = ndc[triangle.v[1]];
+                auto v2 = ndc[triangle.v[2]];
+                auto d = new OctreeData(v0, v1, v2, triangle.id);
                 octree->insert(d);
             }
         }
@@ -88,20 +124,28 @@ struct ZBOctree {
         if (fixed) {
             octree_cache[transform_id] = octree;
         }
+        STATS_END(build);
 
-        drawOctree(octree, colors, image);
+        // Transform id also identifies the instance in the visibility buffer.
+        STATS_BEGIN(raster);
+        drawOctree(octree, colors, image, transform_id);
+        STATS_END(raster);
 
         if (display_octree) {
             octree->drawWireframe(image, octree_color);
         }
+
+        return mesh_visible;
     }
 
 public:
     void drawOctree(Octree * tree,
-                    std::vector<colorf> const& colors,
-                    Image & image) {
+                    std::vector<color8> const& colors,
+                    Image & image,
+                    unsigned int instance_id = 0) {
 
         if (!tree) return;
+        STATS_INC(octree_nodes_visited);
 
         // Render triangle at the center of the node.
         for (int i = 0; i < tree->datas.size(); ++i) {
@@ -114,7 +158,15 @@ public:
             auto e01 = v1 - v0;
             auto e02 = v2 - v0;
             auto N = e01.cross(e02);
-            if (N.z < 0) continue;
+            if (N.z < 0) {
+                STATS_INC(triangles_backface_culled);
+                continue;
+            }
+
+            if (subpixel) {
+                drawTriangleSubpixel(v0, v1, v2, data->id, instance_id, colors, image);
+                continue;
+            }
 
             // Screen mapping.
             v0.x = ftoi((v0.x * 0.5f + 0.5f) * width);
@@ -127,22 +179,38 @@ public:
             auto min = float3::min(v0, float3::min(v1, v2));
             auto max = float3::max(v0, float3::max(v1, v2));
 
-            auto x_min = clamp(ftoi(min.x), 0, width - 1);
-            auto x_max = clamp(ftoi(max.x), 0, width - 1);
-            auto y_min = clamp(ftoi(min.y), 0, height - 1);
-            auto y_max = clamp(ftoi(max.y), 0, height - 1);
+            // Cull triangle if out of screen, before the bounding box is clamped.
+            if (max.x < 0 || min.x > width - 1
+             || max.y < 0 || min.y > height - 1) {
+                STATS_INC(triangles_frustum_culled);
+                continue;
+            }
 
-            // Cull triangle if out of screen.
-            if (x_min > width  || x_max < 0
-             || y_min > height || y_max < 0) continue;
+            // Vertices are snapped to samples, so sub-pixel triangles have no area.
+            auto area = edgeFunction2D(v0, v1, v2);
+            if (area == 0) {
+                STATS_INC(triangles_degenerate);
+                continue;
+            }
 
             // Perspective-correct interpolation.
             v0.z = 1 / v0.z;
             v1.z = 1 / v1.z;
             v2.z = 1 / v2.z;
 
-            auto area = edgeFunction2D(v0, v1, v2);
-            if (area == 0) continue;
+            // A triangle whose bounding box spans 2x2 samples covers exactly
+            // its three vertices, test them without edge functions.
+            if (max.x - min.x == 1 && max.y - min.y == 1) {
+                drawVertex(v0, data->id, instance_id, colors, image);
+                drawVertex(v1, data->id, instance_id, colors, image);
+                drawVertex(v2, data->id, instance_id, colors, image);
+                continue;
+            }
+
+            auto x_min = clamp(ftoi(min.x), 0, width - 1);
+            auto x_max = clamp(ftoi(max.x), 0, width - 1);
+            auto y_min = clamp(ftoi(min.y), 0, height - 1);
+            auto y_max = clamp(ftoi(max.y), 0, height - 1);
 
             // auto level = getMinBoundingLevel(x_min, x_max, y_min, y_max);
             // if (min.z > depth.at((x_min + x_max) / 2, (y_min + y_max) / 2, level)) continue;
@@ -161,12 +229,7 @@ public:
                     auto denom = (w0 * v0.z + w1 * v1.z + w2 * v2.z);
                     pos.z = 1.0f / denom;
 
-                    if (pos.z < 0 || pos.z > 1) continue;
-
-                    if (pos.z > depth.at(x, y, 0)) continue;
-                    
-                    depth.write(x, y, pos.z);
-                    image.setPixel(x, y, colors[data->id]);
+                    drawPixel(x, y, pos.z, data->id, instance_id, colors, image);
                 }
             }
         }
@@ -176,9 +239,10 @@ public:
                 if (!tree->children[i]) continue;
 
                 if (depthTestOctree(tree->children[i])) {
-                    drawOctree(tree->children[i], colors, image);
+                    drawOctree(tree->children[i], colors, image, instance_id);
                 }
                 else {
+                    STATS_INC(octree_nodes_culled);
                     // Skip next child if this child is in the
                     // negative half of z-axis
                     if (i % 2 == 0) ++i;
@@ -187,6 +251,60 @@ public:
         }
     }
 
+    // Vertices are in NDC.
+    void drawTriangleSubpixel(float3 v0, float3 v1, float3 v2, int id, unsigned int instance_id,
+                              std::vector<color8> const& colors, Image & image) {
+        // Screen mapping without snapping.
+        v0 = float3((v0.x * 0.5f + 0.5f) * width, (v0.y * 0.5f + 0.5f) * height, 1 / v0.z);
+        v1 = float3((v1.x * 0.5f + 0.5f) * width, (v1.y * 0.5f + 0.5f) * height, 1 / v1.z);
+        v2 = float3((v2.x * 0.5f + 0.5f) * width, (v2.y * 0.5f + 0.5f) * height, 1 / v2.z);
+
+        FixedTriangle t;
+        if (!t.setup(v0, v1, v2)) {
+            STATS_INC(triangles_degenerate);
+            return;
+        }
+
+        // Cull triangle if out of screen.
+        if (t.x_max < 0 || t.x_min > width - 1
+         || t.y_max < 0 || t.y_min > height - 1) {
+            STATS_INC(triangles_frustum_culled);
+            return;
+        }
+
+        t.rasterize(std::max(t.x_min, 0), std::min(t.x_max, width - 1),
+                    std::max(t.y_min, 0), std::min(t.y_max, height - 1),
+                    [&](int x, int y, float z) {
+            drawPixel(x, y, z, id, instance_id, colors, image);
+        });
+    }
+
+    // Depth test and write a sample covered by triangle id.
+    void drawPixel(int x, int y, float z, int id, unsigned int instance_id,
+                   std::vector<color8> const& colors, Image & image) {
+        if (z < 0 || z > 1) return;
+
+        STATS_INC(pixels_tested);
+        if (count_overdraw) overdraw.test(x, y);
+        if (z > depth.at(x, y, 0)) return;
+
+        STATS_INC(pixels_written);
+        mesh_visible = true;
+        if (count_overdraw) overdraw.write(x, y);
+        depth.write(x, y, z);
+        if (write_visibility) visibility.write(x, y, VisibilityBuffer::encode(instance_id, id));
+        if (!deferred) image.writePixel(x, y, colors[id]);
+    }
+
+    // Vertex v is in screen space with the reciprocal of depth in z.
+    void drawVertex(float3 const& v, int id, unsigned int instance_id,
+                    std::vector<color8> const& colors, Image & image) {
+        int x = v.x;
+        int y = v.y;
+        if (x < 0 || x >= width || y < 0 || y >= height) return;
+        drawPixel(x, y, 1.0f / v.z, id, instance_id, colors, image);
+    }
+
     bool depthTestOctree(Octree * tree) {
         auto x_min = clamp(ftoi(((tree->center.x - tree->halfExtent.x) * 0.5f + 0.5f) * width), 0, width - 1);
         auto x_max = clamp(ftoi(((tree->center.x + tree->halfExtent.x) * 0.5f + 0.5f) * width), 0, width - 1);
@@ -1,23 +1,40 @@
+#pragma once
+
 #include "utils.h"
 #include "vector.h"
 #include "matrix.h"
 #include "mesh.h"
 #include "image.h"
+#include "buffer.h"
+#include "stats.h"
+#include "clipping.h"
+#include "thread_pool.h"
 #include <vector>
 #include <list>
+#include <thread>
+
+// Rows of the screen scanned by one task, bands are spread over the threads.
+#define SCANLINE_BAND_HEIGHT 16
 
 /*
  * * * Scanline Z-Buffer Implementation * * *
  * A modification to scanline conversion by adding support for z-buffering
+ * Visibility is resolved per span instead of per pixel: each scanline is cut
+ * into intervals where the set of covering triangles does not change, and
+ * the nearest triangle is only found by comparing depths at the ends of an
+ * interval. Where depths cross, the interval is split at the crossing.
+ * The screen is split into bands of SCANLINE_BAND_HEIGHT rows, scanned in
+ * parallel, each with its own active edge list.
  * How to use:
- * - Init with screen width and height:
+ * - Init with screen width and height, and optionally the number of threads:
  *      auto rasterizer = ZBScanline(w, h);
  * - Pass vertices, indices etc. to render mesh to image
  *      rasterizer.drawMesh(
  *          mesh,       // # triangle mesh.
- *          colors,     // std::vector<colorf>  size == triangle num # color per triangle.
+ *          colors,     // std::vector<color8>  size == triangle num # quantized color per triangle.
  *          mvp,        // float4x4 # Model View Projection matrix.
- *          image       // Image    # Image as render target, for detail please refer to limage.h'.
+ *          image,      // Image    # Image as render target, for detail please refer to limage.h'.
+ *          instance_id // unsigned int # Instance index written to the visibility buffer, optional.
  *      )
  */
 
@@ -34,7 +51,8 @@ struct ZBScanline {
         int2 max() const { return int2::max(v[0], int2::max(v[1], v[2])); }
     };
     
-    // Sorted Edge Table
+    // Sorted Edge Table, edges of all rows in one array, counting-sorted
+    // by the row where they become active.
     struct SortedEdgeTable {
 
         // Edge struct for sorted edge table
@@ -50,22 +68,106 @@ struct ZBScanline {
 
         int2 min;
         int2 max;
-        std::vector<std::vector<Edge>> table;
+        // Edges of row y are [offset[y - min.y], offset[y - min.y + 1]).
+        std::vector<Edge> edges;
+        std::vector<int> offset;
+        // Rows y_first + k * SCANLINE_BAND_HEIGHT start band k, bands end at y_last.
+        int y_first;
+        int y_last;
+        int band_num;
+        // Per chunk of triangles and band, edges active at the first row of
+        // the band that became active before it, advanced to that row.
+        std::vector<std::vector<Edge>> seeds;
 
-        SortedEdgeTable(std::vector<Triangle> const& tris, int w, int h);
+        // Rows and chunks of triangles are counted and scattered in parallel.
+        void build(std::vector<Triangle> const& tris, int w, int h, ThreadPool & pool);
 
     private:
-        void initTable(std::vector<Triangle> const& tris);
+        // Counts of edges per chunk and row, then where the next edge goes.
+        std::vector<int> chunk_offset;
+
+        void initTable(std::vector<Triangle> const& tris, int h);
+    };
+
+    // Pixels [x0, x1] of a triangle on the current scanline, depth is
+    // z at pixel x_z and changes by dzdx per pixel.
+    struct Span {
+        int x0, x1;
+        int x_z;
+        float z;
+        float dzdx;
+        int id;
+
+        float depth(int x) const { return z + (x - x_z) * dzdx; }
     };
 
     int width, height;
+    VisibilityBuffer visibility;
+    OverdrawBuffer overdraw;
+    // Write (instance, triangle) ids of visible pixels to visibility.
+    bool write_visibility = false;
+    // Depth prepass, skip colors and shade later by visibility.resolve(),
+    // requires write_visibility.
+    bool deferred = false;
+    // Count depth tests and writes of each pixel in overdraw.
+    bool count_overdraw = false;
+    // Cull whole meshlets by frustum and normal cone before
+    // transforming their vertices.
+    bool cull_meshlets = true;
+    // Set when a pixel of the last mesh drawn passed the depth test.
+    bool mesh_visible = false;
+    // Transformed and clipped triangles of the current mesh.
+    VertexStage vertex_stage;
 
-    ZBScanline(int w, int h)
+    ZBScanline(int w, int h, int thread_num = std::thread::hardware_concurrency())
         : width(w)
-        , height(h) {}
+        , height(h)
+        , visibility(w, h)
+        , overdraw(w, h)
+        , pool(std::max(thread_num, 1))
+        , bands(pool.size()) {}
+
+    void clearVisibility() {
+        visibility.clear();
+    }
+
+    void clearOverdraw() {
+        overdraw.clear();
+    }
     
-    void drawMesh(TriangleMesh const& mesh,
-                  std::vector<colorf> const& colors,
+    // Returns true if any pixel of the mesh passed the depth test.
+    bool drawMesh(TriangleMesh const& mesh,
+                  std::vector<color8> const& colors,
                   float4x4 const& mvp,
-                  Image & image);
+                  Image & image,
+                  unsigned int instance_id = 0);
+
+private:
+    // State of the band scanned by one thread, kept to reuse memory.
+    struct Band {
+        std::list<SortedEdgeTable::Edge> AEL;
+        // Spans of the current scanline, sorted by their first pixel, and
+        // indices of those covering the current interval.
+        std::vector<Span> spans;
+        std::vector<Span> sorted_spans;
+        std::vector<int> span_offset;
+        std::vector<int> active;
+        bool visible = false;
+        // Counted per band and added to the stats when all bands are done.
+        long long pixels_tested = 0;
+        long long pixels_written = 0;
+    };
+
+    ThreadPool pool;
+    std::vector<Band> bands; // one per thread
+    std::vector<Triangle> triangles;
+    SortedEdgeTable SET;
+
+    // Scans rows [y0, y1] of the edge table.
+    void drawBand(Band & band, int y0, int y1, std::vector<color8> const& colors,
+                  Image & image, unsigned int instance_id);
+    // Adds pixels of [x0, x1] inside the screen and depth range to spans.
+    void addSpan(Band & band, int x0, int x1, float z, float dzdx, int id);
+    // Fills the nearest span over each interval of the scanline.
+    void drawSpans(Band & band, int y, std::vector<color8> const& colors, Image & image, unsigned int instance_id);
 };
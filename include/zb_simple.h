@@ -6,59 +6,121 @@
 #include "utils.h"
 #include "mesh.h"
 #include "image.h"
+#include "stats.h"
+#include "clipping.h"
+#include "subpixel.h"
+#include "msaa.h"
 #include <iostream>
+#include <memory>
 
 struct ZBSimple {
     int width;
     int height;
     ZBuffer depth;
+    VisibilityBuffer visibility;
+    OverdrawBuffer overdraw;
+    // Write (instance, triangle) ids of visible pixels to visibility.
+    bool write_visibility = false;
+    // Depth prepass, skip colors and shade later by visibility.resolve(),
+    // requires write_visibility.
+    bool deferred = false;
+    // Count depth tests and writes of each pixel in overdraw.
+    bool count_overdraw = false;
+    // Rasterize 24.8 fixed-point positions with a top-left fill rule
+    // instead of snapping vertices to pixels.
+    bool subpixel = false;
+    // Cull whole meshlets by frustum, and normal cone before
+    // transforming their vertices.
+    bool cull_meshlets = true;
+    // Set when a pixel of the last mesh drawn passed the depth test.
+    bool mesh_visible = false;
+    // Transformed and clipped triangles of the current mesh.
+    VertexStage vertex_stage;
+    // Samples of each pixel with multi-sample anti-aliasing, nullptr for
+    // one sample per pixel.
+    std::unique_ptr<MSAABuffer> msaa;
 
     ZBSimple(int w, int h)
         : width(w)
         , height(h)
-        , depth(w, h) {
+        , depth(w, h)
+        , visibility(w, h)
+        , overdraw(w, h) {
         
     }
 
     void clearDepth() {
-        depth.clear(1.0f);
+        if (msaa) msaa->clear();
+        else depth.clear(1.0f);
     }
 
-    void drawMesh(TriangleMesh const& mesh,
-                  std::vector<colorf> const& colors,
+    /**
+     * Draw with 4 or 8 samples per pixel, or 1 to sample pixels only.
+     * Samples are always rasterized with subpixel precision and shaded
+     * forward, resolve() then writes their average to the image.
+     */
+    void setSamples(int samples) {
+        if (samples > 1) msaa.reset(new MSAABuffer(width, height, samples));
+        else msaa.reset();
+    }
+
+    void resolve(Image & image) {
+        if (msaa) msaa->resolve(image);
+    }
+
+    void clearVisibility() {
+        visibility.clear();
+    }
+
+    void clearOverdraw() {
+        overdraw.clear();
+    }
+
+    // Returns true if any pixel of the mesh passed the depth test.
+    bool drawMesh(TriangleMesh const& mesh,
+                  std::vector<color8> const& colors,
                   float4x4 const& mvp,
-                  Image & image) {
+                  Image & image,
+                  unsigned int instance_id = 0) {
                 
-        std::vector<float3> ndc;
-        float3 min = float3(std::numeric_limits<float>::max());
-        float3 max = float3(std::numeric_limits<float>::min());
-        for (int i = 0; i < mesh.vertices.size(); ++i) {
-            auto v = float4(mesh.vertices[i], 1.0f);
-            v = mvp * v;
-            v.w = 1 / v.w;
-            v.x *= v.w;
-            v.y *= v.w;
-            v.z *= v.w;
-            min = float3::min(min, v);
-            max = float3::max(max, v);
-            ndc.push_back(float3(v));
-        }
+        mesh_visible = false;
+        STATS_INC(meshes_submitted);
+        STATS_ADD(triangles_submitted, mesh.indices.size());
+        STATS_BEGIN(transform);
+        auto visible = vertex_stage.process(mesh, mvp, cull_meshlets);
+        STATS_END(transform);
 
         // Cull mesh if out of screen.
-        if (min.x > 1 || max.x < -1
-         || min.y > 1 || max.y < -1 
-         || min.z > 1 || max.z <  0 ) return;
+        if (!visible) {
+            STATS_INC(meshes_culled);
+            return false;
+        }
 
-        for (int i = 0; i < mesh.indices.size(); ++i) {
-            auto v0 = ndc[mesh.indices[i][0]];
-            auto v1 = ndc[mesh.indices[i][1]];
-            auto v2 = ndc[mesh.indices[i][2]];
+        STATS_BEGIN(raster);
+        auto const& ndc = vertex_stage.ndc;
+        for (auto const& triangle : vertex_stage.triangles) {
+            auto v0 = ndc[triangle.v[0]];
+            auto v1 = ndc[triangle.v[1]];
+            auto v2 = ndc[triangle.v[2]];
 
             // Back-face culling.
             auto e01 = v1 - v0;
             auto e02 = v2 - v0;
             auto N = e01.cross(e02);
-            if (N.z < 0) continue;
+            if (N.z < 0) {
+                STATS_INC(triangles_backface_culled);
+                continue;
+            }
+
+            if (msaa) {
+                drawTriangleMSAA(v0, v1, v2, triangle.id, instance_id, colors, image);
+                continue;
+            }
+
+            if (subpixel) {
+                drawTriangleSubpixel(v0, v1, v2, triangle.id, instance_id, colors, image);
+                continue;
+            }
 
             // Screen mapping.
             v0.x = ftoi((v0.x * 0.5f + 0.5f) * width);
@@ -71,22 +133,38 @@ struct ZBSimple {
             auto min = float3::min(v0, float3::min(v1, v2));
             auto max = float3::max(v0, float3::max(v1, v2));
 
-            auto x_min = clamp(ftoi(min.x), 0, width - 1);
-            auto x_max = clamp(ftoi(max.x), 0, width - 1);
-            auto y_min = clamp(ftoi(min.y), 0, height - 1);
-            auto y_max = clamp(ftoi(max.y), 0, height - 1);
+            // Cull triangle if out of screen, before the bounding box is clamped.
+            if (max.x < 0 || min.x > width - 1
+             || max.y < 0 || min.y > height - 1) {
+                STATS_INC(triangles_frustum_culled);
+                continue;
+            }
 
-            // Cull triangle if out of screen.
-            if (x_min > width  || x_max < 0
-             || y_min > height || y_max < 0) continue;
+            // Vertices are snapped to samples, so sub-pixel triangles have no area.
+            auto area = edgeFunction2D(v0, v1, v2);
+            if (area == 0) {
+                STATS_INC(triangles_degenerate);
+                continue;
+            }
 
             // Perspective-correct interpolation.
             v0.z = 1 / v0.z;
             v1.z = 1 / v1.z;
             v2.z = 1 / v2.z;
 
-            auto area = edgeFunction2D(v0, v1, v2);
-            if (area == 0) continue;
+            // A triangle whose bounding box spans 2x2 samples covers exactly
+            // its three vertices, test them without edge functions.
+            if (max.x - min.x == 1 && max.y - min.y == 1) {
+                drawVertex(v0, triangle.id, instance_id, colors, image);
+                drawVertex(v1, triangle.id, instance_id, colors, image);
+                drawVertex(v2, triangle.id, instance_id, colors, image);
+                continue;
+            }
+
+            auto x_min = clamp(ftoi(min.x), 0, width - 1);
+            auto x_max = clamp(ftoi(max.x), 0, width - 1);
+            auto y_min = clamp(ftoi(min.y), 0, height - 1);
+            auto y_max = clamp(ftoi(max.y), 0, height - 1);
 
             for (int x = x_min; x <= x_max; ++x) {
                 for (int y = y_min; y <= y_max; ++y) {
@@ -102,15 +180,211 @@ struct ZBSimple {
                     auto denom = (w0 * v0.z + w1 * v1.z + w2 * v2.z);
                     pos.z = 1.0f / denom;
 
-                    if (pos.z < 0 || pos.z > 1) continue;
+                    drawPixel(x, y, pos.z, triangle.id, instance_id, colors, image);
+                }
+            }
+        }
+        STATS_END(raster);
 
-                    if (pos.z > depth.at(x, y)) continue;
+        return mesh_visible;
+    }
+
+private:
+    // Vertices are in NDC.
+    void drawTriangleSubpixel(float3 v0, float3 v1, float3 v2, int id, unsigned int instance_id,
+                              std::vector<color8> const& colors, Image & image) {
+        // Screen mapping without snapping.
+        v0 = float3((v0.x * 0.5f + 0.5f) * width, (v0.y * 0.5f + 0.5f) * height, 1 / v0.z);
+        v1 = float3((v1.x * 0.5f + 0.5f) * width, (v1.y * 0.5f + 0.5f) * height, 1 / v1.z);
+        v2 = float3((v2.x * 0.5f + 0.5f) * width, (v2.y * 0.5f + 0.5f) * height, 1 / v2.z);
+
+        FixedTriangle t;
+        if (!t.setup(v0, v1, v2)) {
+            STATS_INC(triangles_degenerate);
+            return;
+        }
+
+        // Cull triangle if out of screen.
+        if (t.x_max < 0 || t.x_min > width - 1
+         || t.y_max < 0 || t.y_min > height - 1) {
+            STATS_INC(triangles_frustum_culled);
+            return;
+        }
+
+        t.rasterize(std::max(t.x_min, 0), std::min(t.x_max, width - 1),
+                    std::max(t.y_min, 0), std::min(t.y_max, height - 1),
+                    [&](int x, int y, float z) {
+            drawPixel(x, y, z, id, instance_id, colors, image);
+        });
+    }
+
+    /**
+     * Vertices are in NDC. Samples are tested tile by tile against the
+     * multi-sample buffer. A tile entirely behind the tile's depth range is
+     * skipped, and a tile entirely covered and in front is set to the depth
+     * plane of the triangle without touching its samples.
+     */
+    void drawTriangleMSAA(float3 v0, float3 v1, float3 v2, int id, unsigned int instance_id,
+                          std::vector<color8> const& colors, Image & image) {
+        v0 = float3((v0.x * 0.5f + 0.5f) * width, (v0.y * 0.5f + 0.5f) * height, 1 / v0.z);
+        v1 = float3((v1.x * 0.5f + 0.5f) * width, (v1.y * 0.5f + 0.5f) * height, 1 / v1.z);
+        v2 = float3((v2.x * 0.5f + 0.5f) * width, (v2.y * 0.5f + 0.5f) * height, 1 / v2.z);
+
+        // Triangles between pixel centers may still cover samples.
+        FixedTriangle t;
+        if (!t.setup(v0, v1, v2) && t.area == 0) {
+            STATS_INC(triangles_degenerate);
+            return;
+        }
+
+        // Pixels overlapped by the bounding box, samples may be anywhere in them.
+        int x_min = std::min(t.x[0], std::min(t.x[1], t.x[2])) >> SUBPIXEL_BITS;
+        int x_max = std::max(t.x[0], std::max(t.x[1], t.x[2])) >> SUBPIXEL_BITS;
+        int y_min = std::min(t.y[0], std::min(t.y[1], t.y[2])) >> SUBPIXEL_BITS;
+        int y_max = std::max(t.y[0], std::max(t.y[1], t.y[2])) >> SUBPIXEL_BITS;
+        if (x_max < 0 || x_min > width - 1
+         || y_max < 0 || y_min > height - 1) {
+            STATS_INC(triangles_frustum_culled);
+            return;
+        }
+        x_min = std::max(x_min, 0);
+        x_max = std::min(x_max, width - 1);
+        y_min = std::max(y_min, 0);
+        y_max = std::min(y_max, height - 1);
+
+        auto & buffer = *msaa;
+        int const samples = buffer.samples;
+        auto color = colors[id];
+        auto visibility_id = VisibilityBuffer::encode(instance_id, id);
+
+        // Edge offsets of each sample and the bounds of the sample positions.
+        long long offset[3][MSAA_MAX_SAMPLES];
+        float2 lo(0.0f), hi(0.0f);
+        for (int s = 0; s < samples; ++s) {
+            for (int e = 0; e < 3; ++e) offset[e][s] = t.offset(e, buffer.offset[s].x, buffer.offset[s].y);
+            lo = float2::min(lo, buffer.position[s]);
+            hi = float2::max(hi, buffer.position[s]);
+        }
+        int2 lo_fixed(toFixed(lo.x), toFixed(lo.y));
+        int2 hi_fixed(toFixed(hi.x), toFixed(hi.y));
 
-                    depth.write(x, y, pos.z);
-                    image.setPixel(x, y, colors[i]);
+        // Reciprocal depth is linear in screen space.
+        auto inv_area = 1.0f / t.area;
+        auto ddx = (t.a[0] * t.z[0] + t.a[1] * t.z[1] + t.a[2] * t.z[2]) * inv_area;
+        auto ddy = (t.b[0] * t.z[0] + t.b[1] * t.z[1] + t.b[2] * t.z[2]) * inv_area;
+
+        for (int ty = y_min / MSAA_TILE_SIZE; ty <= y_max / MSAA_TILE_SIZE; ++ty)
+        for (int tx = x_min / MSAA_TILE_SIZE; tx <= x_max / MSAA_TILE_SIZE; ++tx) {
+            auto & tile = buffer.tile(tx, ty);
+            int px0 = tx * MSAA_TILE_SIZE;
+            int py0 = ty * MSAA_TILE_SIZE;
+            int px1 = px0 + MSAA_TILE_SIZE - 1;
+            int py1 = py0 + MSAA_TILE_SIZE - 1;
+            // Pixels of the tile in the bounding box.
+            int rx0 = std::max(px0, x_min);
+            int rx1 = std::min(px1, x_max);
+            int ry0 = std::max(py0, y_min);
+            int ry1 = std::min(py1, y_max);
+
+            // Depth range of the plane over the samples of these pixels, taken
+            // at the corners of the rectangle holding them. If they are the
+            // whole tile, edges at the corners tell if it is covered.
+            auto d0 = (t.edge(0, px0, py0) * t.z[0] + t.edge(1, px0, py0) * t.z[1]
+                     + t.edge(2, px0, py0) * t.z[2]) * inv_area;
+            float d_lo = std::numeric_limits<float>::max();
+            float d_hi = std::numeric_limits<float>::lowest();
+            bool covered = rx0 == px0 && rx1 == px1 && ry0 == py0 && ry1 == py1;
+            for (int corner = 0; corner < 4; ++corner) {
+                int cx = corner & 1 ? rx1 : rx0;
+                int cy = corner & 2 ? ry1 : ry0;
+                auto d = d0 + ddx * (cx - px0 + (corner & 1 ? hi.x : lo.x))
+                            + ddy * (cy - py0 + (corner & 2 ? hi.y : lo.y));
+                d_lo = std::min(d_lo, d);
+                d_hi = std::max(d_hi, d);
+                if (!covered) continue;
+                int ox = corner & 1 ? hi_fixed.x : lo_fixed.x;
+                int oy = corner & 2 ? hi_fixed.y : lo_fixed.y;
+                for (int e = 0; e < 3; ++e) covered &= t.edge(e, cx, cy) + t.offset(e, ox, oy) >= 0;
+            }
+            // With a positive reciprocal the depth range is [1 / d_hi, 1 / d_lo].
+            bool bounded = d_lo > 0;
+            if (bounded && (1 / d_hi > tile.z_max || 1 / d_hi > 1)) continue;
+
+            if (covered && bounded && 1 / d_lo <= tile.z_min && 1 / d_lo <= 1) {
+                buffer.setPlane(tx, ty, float3(ddx, ddy, d0), 1 / d_hi, 1 / d_lo, color, visibility_id);
+                mesh_visible = true;
+                STATS_ADD(pixels_tested, MSAA_TILE_PIXELS);
+                STATS_ADD(pixels_written, MSAA_TILE_PIXELS);
+                for (int y = py0; y <= py1; ++y) for (int x = px0; x <= px1; ++x) {
+                    if (count_overdraw) {
+                        overdraw.test(x, y);
+                        overdraw.write(x, y);
+                    }
+                    if (write_visibility) visibility.write(x, y, visibility_id);
                 }
+                continue;
             }
+
+            auto z_min = tile.z_min;
+            for (int y = ry0; y <= ry1; ++y) for (int x = rx0; x <= rx1; ++x) {
+                long long e[3] = { t.edge(0, x, y), t.edge(1, x, y), t.edge(2, x, y) };
+                int p = (y - py0) * MSAA_TILE_SIZE + (x - px0);
+                bool tested = false;
+                bool written = false;
+                for (int s = 0; s < samples; ++s) {
+                    auto e0 = e[0] + offset[0][s];
+                    auto e1 = e[1] + offset[1][s];
+                    auto e2 = e[2] + offset[2][s];
+                    if ((e0 | e1 | e2) < 0) continue;
+                    auto z = 1.0f / ((e0 * t.z[0] + e1 * t.z[1] + e2 * t.z[2]) * inv_area);
+                    if (z < 0 || z > 1) continue;
+                    tested = true;
+                    if (z > buffer.sampleDepth(tile, p, s)) continue;
+                    if (tile.mode != MSAABuffer::TileMode::Expanded) buffer.expand(tx, ty, image);
+                    buffer.depth(tile, p, s) = z;
+                    buffer.color(tile, p, s) = color;
+                    z_min = std::min(z_min, z);
+                    written = true;
+                }
+                if (tested) {
+                    STATS_INC(pixels_tested);
+                    if (count_overdraw) overdraw.test(x, y);
+                }
+                if (written) {
+                    STATS_INC(pixels_written);
+                    mesh_visible = true;
+                    if (count_overdraw) overdraw.write(x, y);
+                    if (write_visibility) visibility.write(x, y, visibility_id);
+                }
+            }
+            tile.z_min = z_min;
         }
     }
 
+    // Depth test and write a sample covered by triangle id.
+    void drawPixel(int x, int y, float z, int id, unsigned int instance_id,
+                   std::vector<color8> const& colors, Image & image) {
+        if (z < 0 || z > 1) return;
+
+        STATS_INC(pixels_tested);
+        if (count_overdraw) overdraw.test(x, y);
+        if (z > depth.at(x, y)) return;
+
+        STATS_INC(pixels_written);
+        mesh_visible = true;
+        if (count_overdraw) overdraw.write(x, y);
+        depth.write(x, y, z);
+        if (write_visibility) visibility.write(x, y, VisibilityBuffer::encode(instance_id, id));
+        if (!deferred) image.writePixel(x, y, colors[id]);
+    }
+
+    // Vertex v is in screen space with the reciprocal of depth in z.
+    void drawVertex(float3 const& v, int id, unsigned int instance_id,
+                    std::vector<color8> const& colors, Image & image) {
+        int x = v.x;
+        int y = v.y;
+        if (x < 0 || x >= width || y < 0 || y >= height) return;
+        drawPixel(x, y, 1.0f / v.z, id, instance_id, colors, image);
+    }
+
 };
\ No newline at end of file
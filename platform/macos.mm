@@ -18,6 +18,8 @@ struct LuGL::APPWINDOW
     byte_t      *surface;
     int         width;
     int         height;
+    int         channels;
+    long        stride;
     bool        keys[KEY_NUM];
     bool        buttons[BUTTON_NUM];
     bool        should_close;
@@ -231,12 +233,12 @@ void handleMouseScroll(AppWindow *window, float delta)
                           pixelsWide:_window->width
                           pixelsHigh:_window->height
                        bitsPerSample:8
-                     samplesPerPixel:3
-                            hasAlpha:NO
+                     samplesPerPixel:_window->channels
+                            hasAlpha:(_window->channels == 4 ? YES : NO)
                             isPlanar:NO
                       colorSpaceName:NSCalibratedRGBColorSpace
-                         bytesPerRow:_window->width * 3
-                        bitsPerPixel:24] autorelease];
+                         bytesPerRow:_window->stride
+                        bitsPerPixel:_window->channels * 8] autorelease];
     NSImage *nsimage = [[[NSImage alloc] init] autorelease];
     [nsimage addRepresentation:rep];
     [nsimage drawInRect:dirtyRect];
@@ -246,7 +248,7 @@ void handleMouseScroll(AppWindow *window, float delta)
 
 ContentView *g_view;
 
-AppWindow* LuGL::createWindow(const char *title, long width, long height, unsigned char *surface_buffer)
+AppWindow* LuGL::createWindow(const char *title, long width, long height, unsigned char *surface_buffer, int channels, long stride)
 {
     NSUInteger windowStyle = NSWindowStyleMaskTitled | NSWindowStyleMaskClosable | NSWindowStyleMaskResizable;
 
@@ -263,6 +265,8 @@ AppWindow* LuGL::createWindow(const char *title, long width, long height, unsign
     window->surface = surface_buffer;
     window->width = width;
     window->height = height;
+    window->channels = channels;
+    window->stride = stride ? stride : width * channels;
 
     WindowDelegate *delegate;
     delegate = [[WindowDelegate alloc] initWithWindow:window];
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #if defined(_WIN32) || defined(_WIN64) // just to get rid of warning in MacOS
 #include <windows.h>
 #include <utility>
@@ -15,6 +16,8 @@ struct LuGL::APPWINDOW
     byte_t      *surface;
     int         width;
     int         height;
+    int         channels;
+    long        stride;
     bool        keys[KEY_NUM];
     bool        buttons[BUTTON_NUM];
     bool        should_close;
@@ -86,14 +89,45 @@ static void handleMouseScroll(float delta)
     }
 }
 
-static void blitRGB2BGR(const LuGL::byte_t * src, LuGL::byte_t * tar, const size_t & width, const size_t & height)
+static void blitRGB2BGR(const LuGL::byte_t * src, LuGL::byte_t * tar, const size_t & width, const size_t & height, const size_t & stride)
 {
-    size_t image_size = width * height * 3;
-    for (size_t i = 0; i < image_size; i += 3)
+    for (size_t y = 0; y < height; ++y)
     {
-        tar[i] = src[i + 2];
-        tar[i + 1] = src[i + 1];
-        tar[i + 2] = src[i];
+        const LuGL::byte_t * s = src + y * stride;
+        LuGL::byte_t * t = tar + y * width * 3;
+        for (size_t i = 0; i < width * 3; i += 3)
+        {
+            t[i] = s[i + 2];
+            t[i + 1] = s[i + 1];
+            t[i + 2] = s[i];
+        }
+    }
+}
+
+// 32-bit DIB expects BGRX words, swap R and B of every RGBA word.
+static void blitRGBA2BGRA(const LuGL::byte_t * src, LuGL::byte_t * tar, const size_t & width, const size_t & height, const size_t & stride)
+{
+    for (size_t y = 0; y < height; ++y)
+    {
+        const uint32_t * s = reinterpret_cast<const uint32_t *>(src + y * stride);
+        uint32_t * t = reinterpret_cast<uint32_t *>(tar) + y * width;
+        for (size_t x = 0; x < width; ++x)
+        {
+            uint32_t c = s[x];
+            t[x] = (c & 0xff00ff00) | ((c & 0xff) << 16) | ((c >> 16) & 0xff);
+        }
+    }
+}
+
+static void blitSurface()
+{
+    if (g_window->channels == 4)
+    {
+        blitRGBA2BGRA(g_window->surface, g_paint_surface, g_window->width, g_window->height, g_window->stride);
+    }
+    else
+    {
+        blitRGB2BGR(g_window->surface, g_paint_surface, g_window->width, g_window->height, g_window->stride);
     }
 }
 
@@ -108,7 +142,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
     {
         HDC hdc = GetDC(hwnd);
 
-        blitRGB2BGR(g_window->surface, g_paint_surface, g_window->width, g_window->height);
+        blitSurface();
         SetDIBitsToDevice(
             hdc,
             0, 0,
@@ -162,7 +196,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
             {
                 HDC hdc = GetDC(hwnd);
 
-                blitRGB2BGR(g_window->surface, g_paint_surface, g_window->width, g_window->height);
+                blitSurface();
                 SetDIBitsToDevice(
                     hdc,
                     0, 0,
@@ -230,7 +264,7 @@ void LuGL::setWindowTitle(AppWindow *window, const char *title)
 }
 
 
-LuGL::AppWindow* LuGL::createWindow(const char *title, long width, long height, byte_t *surface_buffer)
+LuGL::AppWindow* LuGL::createWindow(const char *title, long width, long height, byte_t *surface_buffer, int channels, long stride)
 {
     HWND hwnd = CreateWindowEx(
         0,
@@ -258,7 +292,7 @@ LuGL::AppWindow* LuGL::createWindow(const char *title, long width, long height,
     MoveWindow(hwnd, winRect.left, winRect.top, width + wDiff, height + hDiff, TRUE);
 
     g_bitmapinfo.bmiHeader.biSize           = sizeof(BITMAPINFOHEADER);
-    g_bitmapinfo.bmiHeader.biBitCount       = 24;
+    g_bitmapinfo.bmiHeader.biBitCount       = channels * 8;
     g_bitmapinfo.bmiHeader.biWidth          = width;
     g_bitmapinfo.bmiHeader.biHeight         = -height;
     g_bitmapinfo.bmiHeader.biCompression    = BI_RGB;
@@ -272,8 +306,10 @@ LuGL::AppWindow* LuGL::createWindow(const char *title, long width, long height,
     g_window->surface = surface_buffer;
     g_window->width = width;
     g_window->height = height;
-    g_paint_surface = new LuGL::byte_t[width * height * 3];
-    memset(g_paint_surface, 0, sizeof(LuGL::byte_t) * width * height * 3);
+    g_window->channels = channels;
+    g_window->stride = stride ? stride : width * channels;
+    g_paint_surface = new LuGL::byte_t[width * height * channels];
+    memset(g_paint_surface, 0, sizeof(LuGL::byte_t) * width * height * channels);
 
     ShowWindow(hwnd, SW_SHOWNORMAL);
     UpdateWindow(hwnd);
@@ -0,0 +1,282 @@
+#include "../include/frame_writer.h"
+#include "../include/utils.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Defined by the stb_image_write implementation in image.cpp but not declared
+// in its header. Unlike stbi_write_png it takes the compression level as an
+// argument, so it does not depend on stb's global settings.
+extern "C" unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality);
+
+FrameWriter::FrameWriter(int thread_num, int queue_depth)
+    : queue_depth(queue_depth) {
+    for (int i = 0; i < thread_num; ++i) {
+        workers.emplace_back(&FrameWriter::work, this);
+    }
+}
+
+FrameWriter::~FrameWriter() {
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    job_ready.notify_all();
+    for (auto & worker : workers) worker.join();
+}
+
+void FrameWriter::writeColor(Image & image, std::string const& path, ColorFileFormat format) {
+    image.resolveClear();
+    auto job = acquire();
+    job.path = path;
+    job.width = image.width;
+    job.height = image.height;
+    job.channels = image.channel();
+    job.is_depth = false;
+    job.color_format = format;
+
+    int row_size = image.width * image.channel();
+    job.pixels.resize(row_size * image.height);
+    for (int y = 0; y < image.height; ++y) {
+        memcpy(job.pixels.data() + y * row_size, image.data + y * image.stride, row_size);
+    }
+    submit(std::move(job));
+}
+
+void FrameWriter::writeDepth(float const* depth, int width, int height, std::string const& path, DepthFileFormat format) {
+    auto job = acquire();
+    job.path = path;
+    job.width = width;
+    job.height = height;
+    job.channels = 1;
+    job.is_depth = true;
+    job.depth_format = format;
+    job.depth.assign(depth, depth + width * height);
+    submit(std::move(job));
+}
+
+void FrameWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    job_done.wait(lock, [this]() { return queue.empty() && busy == 0; });
+}
+
+FrameWriter::Job FrameWriter::acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spare.empty()) return Job();
+    auto job = std::move(spare.back());
+    spare.pop_back();
+    return job;
+}
+
+void FrameWriter::submit(Job && job) {
+    std::unique_lock<std::mutex> lock(mutex);
+    // Bound the number of frames in flight, the render loop waits
+    // here when encoding can not keep up.
+    job_done.wait(lock, [this]() { return (int)queue.size() < queue_depth; });
+    queue.push_back(std::move(job));
+    lock.unlock();
+    job_ready.notify_one();
+}
+
+void FrameWriter::work() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_ready.wait(lock, [this]() { return stop || !queue.empty(); });
+            if (queue.empty()) return;
+            job = std::move(queue.front());
+            queue.pop_front();
+            ++busy;
+        }
+        job_done.notify_all();
+
+        encode(job);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busy;
+            spare.push_back(std::move(job));
+        }
+        job_done.notify_all();
+    }
+}
+
+void FrameWriter::encode(Job const& job) const {
+    if (!job.is_depth) {
+        switch (job.color_format) {
+        case ColorFileFormat::PNG:
+            writePNG(job.path, job.width, job.height, job.channels, 8, job.pixels.data(), png_level); break;
+        case ColorFileFormat::PPM:
+            writePPM(job.path, job.width, job.height, job.channels, job.pixels.data()); break;
+        }
+        return;
+    }
+
+    int size = job.width * job.height;
+    switch (job.depth_format) {
+    case DepthFileFormat::PNG8: {
+        std::vector<unsigned char> rows(size);
+        for (int y = 0; y < job.height; ++y) {
+            auto src = job.depth.data() + (job.height - 1 - y) * job.width;
+            for (int x = 0; x < job.width; ++x) {
+                rows[y * job.width + x] = clamp(src[x], 0.0f, 1.0f) * 255;
+            }
+        }
+        writePNG(job.path, job.width, job.height, 1, 8, rows.data(), png_level);
+        break;
+    }
+    case DepthFileFormat::PNG16: {
+        std::vector<unsigned short> rows(size);
+        for (int y = 0; y < job.height; ++y) {
+            auto src = job.depth.data() + (job.height - 1 - y) * job.width;
+            for (int x = 0; x < job.width; ++x) {
+                rows[y * job.width + x] = clamp(src[x], 0.0f, 1.0f) * 65535;
+            }
+        }
+        writePNG(job.path, job.width, job.height, 1, 16, rows.data(), png_level);
+        break;
+    }
+    case DepthFileFormat::PFM:
+        writePFM(job.path, job.width, job.height, job.depth.data()); break;
+    }
+}
+
+static FILE* openFile(std::string const& path) {
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (fp == nullptr) {
+        std::cout << "Failed to open file: " << path << std::endl;
+    }
+    return fp;
+}
+
+static unsigned int crc32(unsigned int crc, unsigned char const* data, size_t size) {
+    static unsigned int table[256] = { 0 };
+    static bool initialized = [](){
+        for (unsigned int i = 0; i < 256; ++i) {
+            unsigned int c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)initialized;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void writeBigEndian(unsigned char* p, unsigned int v) {
+    p[0] = (v >> 24) & 0xff;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+static void writeChunk(FILE* fp, char const* type, unsigned char const* data, unsigned int size) {
+    unsigned char header[8];
+    writeBigEndian(header, size);
+    memcpy(header + 4, type, 4);
+    auto crc = crc32(crc32(0, header + 4, 4), data, size);
+    unsigned char footer[4];
+    writeBigEndian(footer, crc);
+    fwrite(header, 1, 8, fp);
+    if (size > 0) fwrite(data, 1, size, fp);
+    fwrite(footer, 1, 4, fp);
+}
+
+bool writePNG(std::string const& path, int width, int height, int channels, int bit_depth,
+              void const* rows, int level) {
+    assert(bit_depth == 8 || bit_depth == 16);
+    assert(channels >= 1 && channels <= 4);
+
+    // Every row starts with filter type 0 (none), which keeps encoding cost
+    // in the compressor only. 16-bit samples are stored big-endian.
+    int bytes = bit_depth / 8;
+    int row_size = width * channels * bytes;
+    std::vector<unsigned char> filtered((row_size + 1) * height);
+    auto src = static_cast<unsigned char const*>(rows);
+    for (int y = 0; y < height; ++y) {
+        auto dst = filtered.data() + y * (row_size + 1);
+        dst[0] = 0;
+        if (bytes == 1) {
+            memcpy(dst + 1, src + y * row_size, row_size);
+            continue;
+        }
+        auto samples = static_cast<unsigned short const*>(rows) + y * width * channels;
+        for (int i = 0; i < width * channels; ++i) {
+            dst[1 + i * 2 + 0] = samples[i] >> 8;
+            dst[1 + i * 2 + 1] = samples[i] & 0xff;
+        }
+    }
+
+    int zlib_size = 0;
+    auto zlib = stbi_zlib_compress(filtered.data(), (int)filtered.size(), &zlib_size, level);
+    if (!zlib) return false;
+
+    FILE* fp = openFile(path);
+    if (!fp) {
+        free(zlib);
+        return false;
+    }
+
+    const unsigned char color_types[5] = { 0, 0, 4, 2, 6 };
+    unsigned char ihdr[13];
+    writeBigEndian(ihdr + 0, width);
+    writeBigEndian(ihdr + 4, height);
+    ihdr[8] = bit_depth;
+    ihdr[9] = color_types[channels];
+    ihdr[10] = 0; // deflate
+    ihdr[11] = 0; // adaptive filtering
+    ihdr[12] = 0; // no interlace
+
+    const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    fwrite(signature, 1, 8, fp);
+    writeChunk(fp, "IHDR", ihdr, 13);
+    writeChunk(fp, "IDAT", zlib, zlib_size);
+    writeChunk(fp, "IEND", nullptr, 0);
+    fclose(fp);
+    free(zlib);
+    return true;
+}
+
+bool writePPM(std::string const& path, int width, int height, int channels, unsigned char const* rows) {
+    FILE* fp = openFile(path);
+    if (!fp) return false;
+
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    if (channels == 3) {
+        fwrite(rows, 1, width * height * 3, fp);
+    }
+    else {
+        std::vector<unsigned char> rgb(width * 3);
+        for (int y = 0; y < height; ++y) {
+            auto src = rows + y * width * channels;
+            for (int x = 0; x < width; ++x) {
+                rgb[x * 3 + 0] = src[x * channels + 0];
+                rgb[x * 3 + 1] = src[x * channels + 1];
+                rgb[x * 3 + 2] = src[x * channels + 2];
+            }
+            fwrite(rgb.data(), 1, width * 3, fp);
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+bool writePFM(std::string const& path, int width, int height, float const* rows_bottom_up) {
+    FILE* fp = openFile(path);
+    if (!fp) return false;
+
+    // Negative scale marks little-endian samples, PFM rows go from bottom
+    // to top, which is the order of our depth buffers.
+    unsigned int probe = 1;
+    bool little_endian = *reinterpret_cast<unsigned char*>(&probe) == 1;
+    fprintf(fp, "Pf\n%d %d\n%s\n", width, height, little_endian ? "-1.0" : "1.0");
+    fwrite(rows_bottom_up, sizeof(float), width * height, fp);
+    fclose(fp);
+    return true;
+}
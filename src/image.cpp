@@ -3,53 +3,94 @@
 #include "../thirdparty/stb_image_write.h"
 #include "../include/utils.h"
 #include <memory>
+#include <cstring>
+#include <cstdint>
 
-Image::Image(int w, int h)
-    : width(w)
+Image::Image(int w, int h, int c)
+    : channels(c)
+    , width(w)
     , height(h) {
-    int size = w * h * channel();
-    data = new dataType[size];
+    assert(c == 3 || c == 4);
+    stride = w * c;
+    if (c == 4) {
+        stride = (stride + IMAGE_ALIGNMENT - 1) & ~(IMAGE_ALIGNMENT - 1);
+    }
+    int size = stride * h;
+    storage = new dataType[size + IMAGE_ALIGNMENT];
+    auto address = reinterpret_cast<uintptr_t>(storage);
+    data = storage + ((IMAGE_ALIGNMENT - address % IMAGE_ALIGNMENT) % IMAGE_ALIGNMENT);
     memset(data, 0, size * sizeof(dataType));
+    blocks_x = (w + IMAGE_CLEAR_BLOCK - 1) / IMAGE_CLEAR_BLOCK;
+    cleared.assign(blocks_x * h, 0);
 }
 Image::~Image() {
-    delete data;
+    delete[] storage;
+}
+
+color8 quantize(colorf const& color) {
+    color8 r = clamp(color.r, 0.0f, 1.0f) * 255;
+    color8 g = clamp(color.g, 0.0f, 1.0f) * 255;
+    color8 b = clamp(color.b, 0.0f, 1.0f) * 255;
+    color8 a = clamp(color.a, 0.0f, 1.0f) * 255;
+    return r | (g << 8) | (b << 16) | (a << 24);
 }
 
 void Image::fill(colorf const& color) {
-    int size = width * height;
-    for (int i = 0; i < size; ++i) {
-        int offset = i * channel();
-        data[offset + 0] = clamp(color.r, 0.0f, 1.0f) * 255;
-        data[offset + 1] = clamp(color.g, 0.0f, 1.0f) * 255;
-        data[offset + 2] = clamp(color.b, 0.0f, 1.0f) * 255;
+    fill(quantize(color));
+}
+
+void Image::fill(color8 color) {
+    clear_color = color;
+    std::fill(cleared.begin(), cleared.end(), 1);
+}
+
+void Image::resolveClear() {
+    dataType r = clear_color & 0xff;
+    dataType g = (clear_color >> 8) & 0xff;
+    dataType b = (clear_color >> 16) & 0xff;
+    dataType a = (clear_color >> 24) & 0xff;
+    // Gray colors, including the usual black background, are a memset.
+    bool gray = r == g && g == b && (channels == 3 || a == r);
+    for (int y = 0; y < height; ++y) {
+        auto flags = &cleared[y * blocks_x];
+        // Runs of cleared blocks are filled at once.
+        for (int b0 = 0; b0 < blocks_x; ++b0) {
+            if (!flags[b0]) continue;
+            int b1 = b0;
+            while (b1 + 1 < blocks_x && flags[b1 + 1]) ++b1;
+            int x0 = b0 * IMAGE_CLEAR_BLOCK;
+            int x1 = std::min((b1 + 1) * IMAGE_CLEAR_BLOCK, width) - 1;
+            if (gray) memset(row(y) + x0 * channels, r, (x1 - x0 + 1) * channels);
+            else fillSpan(x0, x1, y, clear_color);
+            std::fill(flags + b0, flags + b1 + 1, 0);
+            b0 = b1;
+        }
     }
 }
 
 void Image::setPixel(int x, int y, colorf const& color) {
     if (x < 0 || x >= width) return;
     if (y < 0 || y >= height) return;
-    int offset = (x + (height - 1 - y) * width) * channel();
-    data[offset + 0] = clamp(color.r, 0.0f, 1.0f) * 255;
-    data[offset + 1] = clamp(color.g, 0.0f, 1.0f) * 255;
-    data[offset + 2] = clamp(color.b, 0.0f, 1.0f) * 255;
+    writePixel(x, y, quantize(color));
 }
 
 void Image::writePNG(std::string const& path) {
-    int stride = width * channel();
-    stride += (stride % 4) ? (4 - stride % 4) : 0;
+    resolveClear();
     stbi_flip_vertically_on_write(false);
     stbi_write_png(path.c_str(), width, height, channel(), data, stride);
 }
 
 void writeDepthToPNG(std::string const& path, int width, int height, float* depth) {
-    int stride = width * 1;
-    stride += (stride % 4) ? (4 - stride % 4) : 0;
-    stbi_flip_vertically_on_write(true);
-    unsigned char* data = new unsigned char[width * height];
-    for (int j = 0; j < width * height; ++j) {
-        data[j] = (unsigned char)(depth[j] * 255);
+    // Depth rows are stored from bottom to top.
+    std::vector<unsigned char> data(width * height);
+    for (int y = 0; y < height; ++y) {
+        auto src = depth + (height - 1 - y) * width;
+        for (int x = 0; x < width; ++x) {
+            data[y * width + x] = (unsigned char)(src[x] * 255);
+        }
     }
-    stbi_write_png(path.c_str(), width, height, 1, data, stride);
+    stbi_flip_vertically_on_write(false);
+    stbi_write_png(path.c_str(), width, height, 1, data.data(), width);
 }
 
 void Image::drawLine(int2 const& v0, int2 const& v1, colorf const& color) {
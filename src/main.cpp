@@ -8,12 +8,14 @@
 #include "../include/image.h"
 #include "../include/utils.h"
 #include "../include/mesh.h"
+#include "../include/scene.h"
 #include "../include/transform.h"
-#include "../include/zb_simple.h"
-#include "../include/zb_scanline.h"
-#include "../include/zb_hierarchical.h"
-#include "../include/zb_octree.h"
+#include "../include/renderer.h"
+#include "../include/stats.h"
+#include "../include/frame_writer.h"
 #include "../include/argparser.h"
+#include <memory>
+#include <cstdio>
 
 // A simple window API that support frame buffer swapping.
 // I transported this window API from my software renderer project:
@@ -46,13 +48,13 @@ static AppWindow *window;
  * To Run:
         -- Z-Buffer Help Info ---------------------------
         Options:
-        -i              Model to load, .obj format.
+        -i              Model to load, .obj format, or scene to load, .scene format.
         -z              Z-Buffer algorithm, the following options available:
             simple      Simple Z-Buffer;
             scanline    Scanline Z-Buffer;
             hiez        Hierarchical Z-Buffer;
             octz        Hierarchical Z-Buffer with Octree Acceleration;
-        -c              Model render count, the following options available:
+        -c              Model render count, ignored for scenes, the following options available:
             1 n         Render 1 * 1 * n models;
             3 n         Render 3 * 3 * n models;
             5 n         Render 5 * 5 * n models;
@@ -62,19 +64,62 @@ static AppWindow *window;
         -p              Projection model, the following options available:
             p           Perspective mode;
             o           Orthogonal mode;
+        -s              Shading mode, the following options available:
+            f           Forward mode, shade on every depth test pass;
+            d           Deferred mode, depth prepass and shade each pixel once;
+        -f              Framebuffer format, the following options available:
+            rgb         3 channels, tightly packed rows;
+            rgba        4 channels, 64-byte aligned rows;
+        -r              Rasterization precision, the following options available:
+            pixel       Snap vertices to pixels;
+            subpixel    24.8 fixed point with top-left fill rule, not for scanline;
+        -l              Meshlet culling, the following options available:
+            on          Cull meshlets by frustum, normal cone and depth pyramid;
+            off         Process every triangle;
+        -k              Vertex cache reordering on load, the following options available:
+            on          Reorder triangles and vertices for vertex reuse;
+            off         Only sort triangles in Morton order, keep the file vertex order;
+        -t              Two-phase occlusion culling (hiez, octz, octzf), the following options available:
+            on          Draw instances visible in the last frame first, cull the others against them;
+            off         Draw every instance;
+        -x              Occluder pass, the following options available:
+            on          Draw the largest instances at low resolution first, cull instances behind them;
+            off         No occluder pass;
+        -e              Levels of detail, the following options available:
+            on          Simplify meshes on load, cached in <model>.lod, draw by size on screen;
+            off         Draw full detail meshes;
+        -a              Multi-sample anti-aliasing (simple), the following options available:
+            1           One sample per pixel;
+            4           4 samples per pixel, depth compressed per tile;
+            8           8 samples per pixel, depth compressed per tile;
+        -q              Depth storage, base level then pyramid (simple, hiez, octz, octzf):
+            f32 | u24 | u16  Base level in 32-bit floats or unorm 24 or 16 bits;
+            f32 | u16 | u8   Pyramid in 32-bit floats or unorm 16 or 8 bits, rounded conservatively;
+        -v              Dump (instance, triangle) id of each pixel of the last frame to the given file.
+        -w              Write every frame in background to <prefix><frame>.<format>:
+            prefix png  PNG with fast compression;
+            prefix ppm  Uncompressed PPM;
+        -d              Write depth of every frame in background to <prefix><frame>.<format>:
+            prefix png8  8-bit PNG;
+            prefix png16 16-bit PNG;
+            prefix pfm   32-bit float PFM;
+        -o              Count depth tests and writes per pixel, write heatmaps of the last frame
+                        to <prefix>_tests.png and <prefix>_writes.png and print overdraw ratios.
  * Samples:
         ./viewer -i meshes/spot.obj
         ./viewer -i meshes/spot.obj -c 3 3
         ./viewer -i meshes/spot.obj -c 3 3 -z hiez
         ./viewer -i meshes/spot.obj -c 5 3 -z scanline -p o -m b 10
+        ./viewer -i meshes/spot.obj -c 3 3 -z hiez -r subpixel -o overdraw
+        ./viewer -i scenes/sample.scene -z hiez
+        ./viewer -i meshes/spot.obj -c 5 3 -e on
+        ./viewer -i meshes/spot.obj -a 4
+        ./viewer -i meshes/spot.obj -c 5 3 -z hiez -q u16 u8
  */
 
 Arguments args;
 
-float camera_fov = PI() * 0.2;
-float camera_z = -6.0f;
-float rotate_x = 0.0f;
-float rotate_y = 0.0f;
+Camera camera;
 
 int main(int argc, char* argv[]) {
     if (!parse(argc, argv, &args)) {
@@ -84,8 +129,9 @@ int main(int argc, char* argv[]) {
     initializeApplication();
 
     const char * title = "Viewer @ LuGL";
-    Image image(scr_w, scr_h);
-    window = createWindow(title, scr_w, scr_h, image.data);
+    int channels = args.framebuffer_format == FramebufferFormat::RGBA8 ? 4 : 3;
+    Image image(scr_w, scr_h, channels);
+    window = createWindow(title, scr_w, scr_h, image.data, image.channel(), image.stride);
 
     setKeyboardCallback(window, keyboardEventCallback);
     setMouseButtonCallback(window, mouseButtonEventCallback);
@@ -97,34 +143,53 @@ int main(int argc, char* argv[]) {
 /////////////////////////////////////////////////////////////////////////////////////////////
 
     float3 light_dir = float3(1.0, 1.0, -1.0).normalized();
-    TriangleMesh mesh{ args.model };
-    std::vector<colorf> colors;
-    // Shade per triangle.
-    for (size_t i = 0; i < mesh.indices.size(); ++i) {
-        auto v0 = mesh.vertices[mesh.indices[i][0]];
-        auto v1 = mesh.vertices[mesh.indices[i][1]];
-        auto v2 = mesh.vertices[mesh.indices[i][2]];
-
-        auto e01 = v1 - v0;
-        auto e02 = v2 - v0;
-        auto normal = e01.cross(e02).normalized();
-        // Shade by diffuse lighting.
-        auto shading = light_dir.dot(normal);
-        shading = clamp(shading, 0.05f, 1.0f);
-
-        colors.emplace_back(float3(shading), 1.0f);
+    // A scene lists meshes and their instances, a single model is drawn in a grid.
+    std::unique_ptr<Scene> scene;
+    std::unique_ptr<TriangleMesh> mesh;
+    // Shade per triangle, quantized once for all frames.
+    std::vector<std::vector<color8>> colors;
+    auto const& model = args.model;
+    if (model.size() >= 6 && model.compare(model.size() - 6, 6, ".scene") == 0) {
+        scene.reset(new Scene(model, args.reorder, args.lod));
+        size_t triangles = 0;
+        for (auto const& instance : scene->instances) {
+            triangles += scene->meshes[instance.mesh].indices.size();
+        }
+        for (auto const& m : scene->meshes) {
+            colors.push_back(shadeTriangles(m, light_dir));
+        }
+        std::cout << "Meshes: " << scene->meshes.size()
+                  << ", instances: " << scene->instances.size()
+                  << ", triangles: " << triangles << std::endl;
+    }
+    else {
+        mesh.reset(new TriangleMesh(model, args.reorder, args.lod));
+        colors.push_back(shadeTriangles(*mesh, light_dir));
+        std::cout << "Triangles: " << mesh->indices.size() << std::endl;
     }
 
-    std::cout << "Triangles: " << mesh.indices.size() << std::endl;
-
-    ZBSimple simpleZBuffer(scr_w, scr_h);
-    ZBScanline scanlineZBuffer(scr_w, scr_h);
-    ZBHierarchical hierarchicalZBuffer(scr_w, scr_h);
-    ZBOctree octreeZBuffer(scr_w, scr_h);
+    Renderer renderer(scr_w, scr_h);
+    bool deferred = args.shading_mode == ShadingMode::Deferred;
+    renderer.setDeferred(deferred);
+    renderer.setWriteVisibility(deferred || !args.visibility_path.empty());
+    renderer.setCountOverdraw(!args.overdraw_prefix.empty());
+    renderer.setSubpixel(args.raster_precision == RasterPrecision::Subpixel);
+    renderer.setCullMeshlets(args.cull_meshlets);
+    renderer.setTwoPhase(args.two_phase);
+    renderer.setOccluderPass(args.occluder_pass);
+    renderer.setLOD(args.lod);
+    renderer.setSamples(args.samples);
+    renderer.setDepthFormat(args.depth_precision, args.pyramid_precision);
+
+    // Frames are encoded by background threads while the next frames render.
+    std::unique_ptr<FrameWriter> frame_writer;
+    if (!args.frame_prefix.empty() || !args.depth_prefix.empty()) {
+        frame_writer.reset(new FrameWriter());
+    }
+    int frame_index = 0;
 
     int c = args.draw_count[0] / 2;
     int n = args.draw_count[1];
-    auto proj = float4x4::identity();
 
     // Benchmark variables.
     int counter = 0;
@@ -139,67 +204,17 @@ int main(int argc, char* argv[]) {
 /////////////////////////////////////////////////////////////////////////////////////////////
 
         // Transform setup.
-        auto aspect_ratio = (float)scr_h / scr_w;
-        switch (args.proj_mode) {
-        case ProjectionMode::Perspective:
-            proj = perspective(camera_fov, (float)scr_h / scr_w); break;
-        case ProjectionMode::Orthogonal:
-            proj = ortho(-2, 2, -2 * aspect_ratio, 1 * aspect_ratio, -1000, 1000); break;
-        }
-        auto model = translate(0, 0, 0);
-        auto view = lookAt(mesh.center + float3(0, 0, camera_z), mesh.center, float3(0, 1, 0));
-        auto mvp = proj * view * model;
-    
+        auto proj = projection(args.proj_mode, camera, scr_w, scr_h);
+
         // Clear framebuffer.
         image.fill(colorf{0, 0, 0, 1});
 
         // In benchmark mode, we only record the runtime of the algorithm.
         if (args.render_mode == RenderMode::Benchmark) t.update();
 
-        switch (args.algorithm) {
-        case ZBufferAlgorithm::SimpleZBuffer:
-            simpleZBuffer.clearDepth();
-            for (int x = -c; x <= c; ++x) for (int y = -c; y <= c; ++y) for (int z = -1; z <= n - 2; ++z) {
-                model = rotateX(rotate_x) * rotateY(rotate_y) * translate(x, y, z);
-                mvp = proj * view * model; 
-                simpleZBuffer.drawMesh(mesh, colors, mvp, image);
-            }
-            break;
-        case ZBufferAlgorithm::ScanlineZBuffer:
-            for (int x = -c; x <= c; ++x) for (int y = -c; y <= c; ++y) for (int z = -1; z <= n - 2; ++z) {
-                model = rotateX(rotate_x) * rotateY(rotate_y) * translate(x, y, z);
-                mvp = proj * view * model; 
-                scanlineZBuffer.drawMesh(mesh, colors, mvp, image);
-            }
-            break;
-        case ZBufferAlgorithm::HierarchicalZBuffer:
-            hierarchicalZBuffer.clearDepth();
-            for (int x = -c; x <= c; ++x) for (int y = -c; y <= c; ++y) for (int z = -1; z <= n - 2; ++z) {
-                model = rotateX(rotate_x) * rotateY(rotate_y) * translate(x, y, z);
-                mvp = proj * view * model; 
-                hierarchicalZBuffer.drawMesh(mesh, colors, mvp, image);
-            }
-            break;
-        case ZBufferAlgorithm::OctreeZBuffer:
-            octreeZBuffer.clearDepth();
-            for (int x = -c; x <= c; ++x) for (int y = -c; y <= c; ++y) for (int z = -1; z <= n - 2; ++z) {
-                model = rotateX(rotate_x) * rotateY(rotate_y) * translate(x, y, z);
-                mvp = proj * view * model; 
-                octreeZBuffer.drawMesh(mesh, colors, mvp, image);
-            }
-            break;
-        case ZBufferAlgorithm::OctreeZBufferFixed:
-            octreeZBuffer.clearDepth();
-            octreeZBuffer.fixed = true;
-            unsigned int id = 0;
-            for (int x = -c; x <= c; ++x) for (int y = -c; y <= c; ++y) for (int z = -1; z <= n - 2; ++z) {
-                model = rotateX(rotate_x) * rotateY(rotate_y) * translate(x, y, z);
-                mvp = proj * view * model; 
-                octreeZBuffer.drawMesh(mesh, colors, mvp, image, id);
-                ++id;
-            }
-            break;
-        }
+        STATS_RESET();
+        if (scene) renderer.drawScene(args.algorithm, *scene, colors, proj, camera, image);
+        else renderer.drawGrid(args.algorithm, *mesh, colors[0], proj, camera, c, n, image);
 
         // Benchmark functionality, to record runtime of each render stage.
         // In Benchmark mode, program will automatically terminate at render_count frames
@@ -208,17 +223,48 @@ int main(int argc, char* argv[]) {
             t.update();
             total_elapsed += t.deltaTime();
             counter++;
+            // Only available when compiled with ZB_ENABLE_STATS.
+            STATS_REPORT(std::cout);
             if (counter == args.render_count) {
                 std::cout << "Elapsed time per frame: " << total_elapsed * 1000 / args.render_count << "ms\n";
                 destroyWindow(window);
             }
         }
 
+        // Blocks not drawn since the clear are filled before the frame is read.
+        image.resolveClear();
+
+        if (frame_writer) {
+            char index[16];
+            snprintf(index, sizeof(index), "%04d", frame_index);
+            if (!args.frame_prefix.empty()) {
+                const char * ext = args.frame_format == ColorFileFormat::PPM ? ".ppm" : ".png";
+                frame_writer->writeColor(image, args.frame_prefix + index + ext, args.frame_format);
+            }
+            float * depth = renderer.depthBuffer(args.algorithm);
+            if (!args.depth_prefix.empty() && depth) {
+                const char * ext = args.depth_format == DepthFileFormat::PFM ? ".pfm" : ".png";
+                frame_writer->writeDepth(depth, scr_w, scr_h, args.depth_prefix + index + ext, args.depth_format);
+            }
+            ++frame_index;
+        }
+
         UPDATE_FPS();
         swapBuffer(window);
         pollEvent();
     }
 
+    if (!args.visibility_path.empty()) {
+        renderer.visibilityBuffer(args.algorithm).writeBinary(args.visibility_path);
+    }
+
+    if (!args.overdraw_prefix.empty()) {
+        auto const& overdraw = renderer.overdrawBuffer(args.algorithm);
+        overdraw.report(std::cout);
+        overdraw.writeHeatmap(args.overdraw_prefix + "_tests.png", false);
+        overdraw.writeHeatmap(args.overdraw_prefix + "_writes.png", true);
+    }
+
     terminateApplication();
     return 0;
 }
@@ -243,8 +289,8 @@ void keyboardEventCallback(AppWindow *window, KEY_CODE key, bool pressed) {
             destroyWindow(window);
             break;
         case KEY_SPACE:
-            rotate_x = 0.0f;
-            rotate_y = 0.0f;
+            camera.rotate_x = 0.0f;
+            camera.rotate_y = 0.0f;
             break;
         default:
             return;
@@ -262,8 +308,8 @@ void mouseButtonEventCallback(AppWindow *window, MOUSE_BUTTON button, bool press
 void mouseScrollEventCallback(AppWindow *window, float offset) {
     __unused_variable(window);
     if (args.algorithm == ZBufferAlgorithm::OctreeZBufferFixed) return;
-    camera_fov += offset * 0.01f;
-    camera_fov = clamp(camera_fov, 0.02f, 0.5f);
+    camera.fov += offset * 0.01f;
+    camera.fov = clamp(camera.fov, 0.02f, 0.5f);
 }
 float last_x;
 float last_y;
@@ -279,8 +325,8 @@ void mouseDragEventCallback(AppWindow *window, float x, float y) {
         float delta_x = x - last_x;
         float delta_y = y - last_y;
 
-        rotate_y += delta_x * 0.01f;
-        rotate_x -= delta_y * 0.01f;
+        camera.rotate_y += delta_x * 0.01f;
+        camera.rotate_x -= delta_y * 0.01f;
 
         last_x = x;
         last_y = y;
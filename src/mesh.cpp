@@ -1,10 +1,13 @@
 #include "../include/mesh.h"
 #include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
 
-TriangleMesh::TriangleMesh(std::string const& path)
+TriangleMesh::TriangleMesh(std::string const& path, bool reorder, bool lod)
     : center(0)
     , min(std::numeric_limits<float>::max())
-    , max(std::numeric_limits<float>::min()) {
+    , max(std::numeric_limits<float>::lowest()) {
     FILE *fp;
     fp = fopen(path.c_str(), "rb");
     if (fp == nullptr) {
@@ -59,5 +62,247 @@ TriangleMesh::TriangleMesh(std::string const& path)
     }
     center = center / vertices.size();
     fclose(fp);
+
+    // Face order of the file, kept as the triangle ids through reordering.
+    source.resize(indices.size());
+    std::iota(source.begin(), source.end(), 0);
+    sortTriangles();
+    if (reorder) optimizeVertexOrder();
+    buildMeshlets();
+    if (lod) buildLODs(path + ".lod");
+}
+
+TriangleMesh::TriangleMesh(std::vector<float3> const& _vertices,
+                           std::vector<int3> const& _indices,
+                           std::vector<int> const& _source)
+    : vertices(_vertices)
+    , indices(_indices)
+    , center(0)
+    , min(std::numeric_limits<float>::max())
+    , max(std::numeric_limits<float>::lowest())
+    , source(_source) {
+    for (auto const& v : vertices) {
+        min = float3::min(min, v);
+        max = float3::max(max, v);
+        center = center + v;
+    }
+    if (!vertices.empty()) center = center / vertices.size();
+
+    sortTriangles();
+    optimizeVertexOrder();
+    buildMeshlets();
+}
+
+// Interleave the lower 10 bits of x, y and z.
+static unsigned int mortonCode(unsigned int x, unsigned int y, unsigned int z) {
+    auto spread = [](unsigned int v) {
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    };
+    return (spread(x) << 2) | (spread(y) << 1) | spread(z);
+}
+
+void TriangleMesh::sortTriangles() {
+    // Sort triangles by the Morton code of their centroids, so that
+    // consecutive triangles are close to each other.
+    auto extent = max - min;
+    auto scale = float3(extent.x > 0 ? 1023 / extent.x : 0,
+                        extent.y > 0 ? 1023 / extent.y : 0,
+                        extent.z > 0 ? 1023 / extent.z : 0);
+    std::vector<std::pair<unsigned int, int>> keys(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        auto c = (vertices[indices[i][0]] + vertices[indices[i][1]] + vertices[indices[i][2]]) / 3;
+        auto q = c - min;
+        keys[i] = { mortonCode(q.x * scale.x, q.y * scale.y, q.z * scale.z), (int)i };
+    }
+    std::stable_sort(keys.begin(), keys.end(), [](std::pair<unsigned int, int> const& a,
+                                                  std::pair<unsigned int, int> const& b) {
+        return a.first < b.first;
+    });
+    std::vector<int3> sorted;
+    sorted.reserve(indices.size());
+    for (auto const& key : keys) sorted.push_back(indices[key.second]);
+    indices.swap(sorted);
+    if (!source.empty()) {
+        std::vector<int> sorted_source;
+        sorted_source.reserve(source.size());
+        for (auto const& key : keys) sorted_source.push_back(source[key.second]);
+        source.swap(sorted_source);
+    }
+}
+
+void TriangleMesh::buildMeshlets() {
+    meshlets.clear();
+
+    int triangle_num = indices.size();
+    for (int first = 0; first < triangle_num; first += MESHLET_MAX_TRIANGLES) {
+        Meshlet m;
+        m.first = first;
+        m.count = std::min(MESHLET_MAX_TRIANGLES, triangle_num - first);
+
+        // Bounding sphere around the center of the bounding box.
+        auto m_min = float3(std::numeric_limits<float>::max());
+        auto m_max = float3(std::numeric_limits<float>::lowest());
+        for (int i = first; i < first + m.count; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                m_min = float3::min(m_min, vertices[indices[i][j]]);
+                m_max = float3::max(m_max, vertices[indices[i][j]]);
+            }
+        }
+        m.center = (m_min + m_max) / 2;
+        m.radius = 0.0f;
+        for (int i = first; i < first + m.count; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                auto d = vertices[indices[i][j]] - m.center;
+                m.radius = std::max(m.radius, std::sqrt(d.dot(d)));
+            }
+        }
+
+        // Normal cone around the average normal.
+        std::vector<float3> normals;
+        auto axis = float3(0.0f);
+        for (int i = first; i < first + m.count; ++i) {
+            auto v0 = vertices[indices[i][0]];
+            auto n = (vertices[indices[i][1]] - v0).cross(vertices[indices[i][2]] - v0);
+            auto length = std::sqrt(n.dot(n));
+            if (length == 0) continue;
+            normals.push_back(n / length);
+            axis = axis + normals.back();
+        }
+        m.cone_axis = float3(0.0f);
+        m.cone_cutoff = 1.0f;
+        if (axis.dot(axis) > 0) {
+            m.cone_axis = axis.normalized();
+            auto min_dot = 1.0f;
+            for (auto const& n : normals) min_dot = std::min(min_dot, n.dot(m.cone_axis));
+            // Cones wider than a hemisphere can not be back-facing as a whole.
+            if (min_dot > 0) m.cone_cutoff = std::sqrt(1 - min_dot * min_dot);
+        }
+        meshlets.push_back(m);
+    }
 }
 
+
+// Vertex score of Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+// cache_position is -1 for vertices not in the cache.
+static float vertexScore(int cache_position, int remaining) {
+    if (remaining == 0) return -1.0f;
+    float score = 0.0f;
+    if (cache_position >= 0) {
+        // The last triangle's vertices get a fixed score, so that
+        // the next triangle does not reuse them too eagerly.
+        if (cache_position < 3) score = 0.75f;
+        else score = std::pow(1.0f - (float)(cache_position - 3) / (VERTEX_CACHE_SIZE - 3), 1.5f);
+    }
+    // Prefer vertices with few triangles left, so that they leave the cache.
+    return score + 2.0f * std::pow((float)remaining, -0.5f);
+}
+
+void TriangleMesh::optimizeVertexOrder() {
+    int triangle_num = indices.size();
+    int vertex_num = vertices.size();
+
+    // Triangles using each vertex, the first remaining[v] of them are not emitted yet.
+    std::vector<int> remaining(vertex_num, 0);
+    for (auto const& t : indices) {
+        for (int j = 0; j < 3; ++j) ++remaining[t[j]];
+    }
+    std::vector<int> offset(vertex_num + 1, 0);
+    for (int v = 0; v < vertex_num; ++v) offset[v + 1] = offset[v] + remaining[v];
+    std::vector<int> adjacency(offset[vertex_num]);
+    std::vector<int> cursor(offset.begin(), offset.end() - 1);
+    for (int i = 0; i < triangle_num; ++i) {
+        for (int j = 0; j < 3; ++j) adjacency[cursor[indices[i][j]]++] = i;
+    }
+
+    std::vector<int> cache_position(vertex_num, -1);
+    std::vector<float> vertex_score(vertex_num);
+    for (int v = 0; v < vertex_num; ++v) vertex_score[v] = vertexScore(-1, remaining[v]);
+    std::vector<float> triangle_score(triangle_num);
+    for (int i = 0; i < triangle_num; ++i) {
+        auto const& t = indices[i];
+        triangle_score[i] = vertex_score[t[0]] + vertex_score[t[1]] + vertex_score[t[2]];
+    }
+
+    std::vector<char> emitted(triangle_num, 0);
+    std::vector<int3> ordered;
+    ordered.reserve(triangle_num);
+    std::vector<int> ordered_source;
+    ordered_source.reserve(source.size());
+    std::vector<int> cache, next_cache;
+    // Triangles are already in Morton order, restart from the first one
+    // left when no triangle touches the cache.
+    int seed = 0;
+    int best = -1;
+    for (int k = 0; k < triangle_num; ++k) {
+        if (best < 0) {
+            while (emitted[seed]) ++seed;
+            best = seed;
+        }
+        emitted[best] = 1;
+        auto t = indices[best];
+        ordered.push_back(t);
+        if (!source.empty()) ordered_source.push_back(source[best]);
+
+        for (int j = 0; j < 3; ++j) {
+            auto v = t[j];
+            auto first = adjacency.begin() + offset[v];
+            auto last = first + remaining[v];
+            std::iter_swap(std::find(first, last, best), last - 1);
+            --remaining[v];
+        }
+
+        // Move the triangle's vertices to the front of the cache, vertices
+        // pushed out are still rescored below.
+        next_cache.assign({ t[0], t[1], t[2] });
+        for (auto v : cache) {
+            if (v != t[0] && v != t[1] && v != t[2]) next_cache.push_back(v);
+        }
+        for (size_t i = 0; i < next_cache.size(); ++i) {
+            cache_position[next_cache[i]] = i < VERTEX_CACHE_SIZE ? i : -1;
+        }
+        for (auto v : next_cache) {
+            auto score = vertexScore(cache_position[v], remaining[v]);
+            auto diff = score - vertex_score[v];
+            vertex_score[v] = score;
+            for (int i = offset[v]; i < offset[v] + remaining[v]; ++i) triangle_score[adjacency[i]] += diff;
+        }
+        if (next_cache.size() > VERTEX_CACHE_SIZE) next_cache.resize(VERTEX_CACHE_SIZE);
+        cache.swap(next_cache);
+
+        // Next triangle is the best one touching the cache.
+        best = -1;
+        float best_score = 0.0f;
+        for (auto v : cache) {
+            for (int i = offset[v]; i < offset[v] + remaining[v]; ++i) {
+                if (triangle_score[adjacency[i]] > best_score) {
+                    best_score = triangle_score[adjacency[i]];
+                    best = adjacency[i];
+                }
+            }
+        }
+    }
+    indices.swap(ordered);
+    if (!source.empty()) source.swap(ordered_source);
+
+    // Number vertices in the order of first use, unused vertices go last.
+    std::vector<int> remap(vertex_num, -1);
+    std::vector<float3> sorted;
+    sorted.reserve(vertex_num);
+    for (auto & t : indices) {
+        for (int j = 0; j < 3; ++j) {
+            if (remap[t[j]] < 0) {
+                remap[t[j]] = sorted.size();
+                sorted.push_back(vertices[t[j]]);
+            }
+            t[j] = remap[t[j]];
+        }
+    }
+    for (int v = 0; v < vertex_num; ++v) {
+        if (remap[v] < 0) sorted.push_back(vertices[v]);
+    }
+    vertices.swap(sorted);
+}
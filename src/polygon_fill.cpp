@@ -0,0 +1,145 @@
+#include "../include/polygon_fill.h"
+#include <algorithm>
+#include <cmath>
+
+using Edge = PolygonFill::SortedEdgeTable::Edge;
+static bool compareEdge(Edge const& first, Edge const& second) {
+    if (first.id != second.id) {
+        return first.id < second.id;
+    } else if (first.x != second.x) {
+        return first.x < second.x;
+    } else {
+        return first.dx < second.dx;
+    }
+}
+
+void PolygonFill::draw(std::vector<Polygon> const& polygons, FillRule rule, Image & image) {
+    assert(image.width == width && image.height == height);
+    SET.build(polygons, height);
+    if (SET.y_first > SET.y_last) return;
+
+    int band_first = SET.y_first / POLYGON_BAND_HEIGHT;
+    int band_num = SET.y_last / POLYGON_BAND_HEIGHT - band_first + 1;
+    pool.run(band_num, [&](int k, int worker) {
+        auto & band = bands[worker];
+        band.AEL.clear();
+        int y0 = std::max((band_first + k) * POLYGON_BAND_HEIGHT, SET.y_first);
+        int y1 = std::min((band_first + k + 1) * POLYGON_BAND_HEIGHT - 1, SET.y_last);
+        drawBand(band, y0, y1, polygons, rule, image);
+    });
+}
+
+void PolygonFill::drawBand(Band & band, int y0, int y1, std::vector<Polygon> const& polygons,
+                           FillRule rule, Image & image) {
+    auto & AEL = band.AEL;
+    for (int y = y0; y <= y1; ++y) {
+        // Append new edges.
+        for (int i = SET.offset[y]; i < SET.offset[y + 1]; ++i) {
+            AEL.push_back(SET.edges[i]);
+        }
+        // Sort edges by polygon and x, the list is nearly sorted from the
+        // last row so insertion sort is fast.
+        for (int i = 1; i < (int)AEL.size(); ++i) {
+            auto e = AEL[i];
+            int j = i;
+            for (; j > 0 && compareEdge(e, AEL[j - 1]); --j) AEL[j] = AEL[j - 1];
+            AEL[j] = e;
+        }
+
+        // Fill pixels whose center lies where the winding number of the
+        // polygon is inside by the fill rule.
+        int winding = 0;
+        float x_in = 0;
+        for (int i = 0; i < (int)AEL.size(); ++i) {
+            auto const& e = AEL[i];
+            if (i == 0 || e.id != AEL[i - 1].id) winding = 0;
+            bool was_inside = rule == FillRule::EvenOdd ? (winding & 1) : winding != 0;
+            winding += e.winding;
+            bool inside = rule == FillRule::EvenOdd ? (winding & 1) : winding != 0;
+            if (!was_inside && inside) {
+                x_in = e.x;
+            }
+            else if (was_inside && !inside) {
+                // Clamp before converting, x may be far outside the image.
+                float x0 = std::max(std::ceil(x_in - 0.5f), 0.0f);
+                float x1 = std::min(std::ceil(e.x - 0.5f) - 1.0f, itof(width - 1));
+                if (x0 <= x1) image.writeSpan(ftoi(x0), ftoi(x1), y, polygons[e.id].color);
+            }
+        }
+
+        // Update x in edges and remove used edges.
+        int n = 0;
+        for (auto & e : AEL) {
+            if (e.y_max == y) continue;
+            e.x += e.dx;
+            AEL[n++] = e;
+        }
+        AEL.resize(n);
+    }
+}
+
+// Rows [first, last] whose centers are crossed by the edge from a to b inside
+// an image of h rows, the edge is stored with x at row first.
+static bool polygonEdge(float2 a, float2 b, int id, int h, Edge & e, int & first) {
+    e.winding = 1;
+    if (a.y > b.y) {
+        std::swap(a, b);
+        e.winding = -1;
+    }
+    // Rows y with a.y <= y + 0.5 < b.y, clamped as floats to also reject
+    // vertices that are not finite.
+    float y0 = std::max(std::ceil(a.y - 0.5f), 0.0f);
+    float y1 = std::min(std::ceil(b.y - 0.5f) - 1.0f, itof(h - 1));
+    if (!(y0 <= y1)) return false;
+    first = ftoi(y0);
+    e.y_max = ftoi(y1);
+    e.dx = (b.x - a.x) / (b.y - a.y);
+    e.x = a.x + (y0 + 0.5f - a.y) * e.dx;
+    e.id = id;
+    return true;
+}
+
+// Calls add(edge, row) for each band crossed by each edge, with the edge
+// advanced to the first row of the band.
+template<typename F>
+static void forEachEdge(std::vector<Polygon> const& polygons, int h, F const& add) {
+    Edge e;
+    int first;
+    for (int id = 0; id < (int)polygons.size(); ++id) {
+        for (auto const& contour : polygons[id].contours) {
+            int vn = contour.size();
+            for (int i = 0; i < vn; ++i) {
+                if (!polygonEdge(contour[i], contour[(i + 1) % vn], id, h, e, first)) continue;
+                float x = e.x;
+                for (int y = first; y <= e.y_max; y = (y / POLYGON_BAND_HEIGHT + 1) * POLYGON_BAND_HEIGHT) {
+                    e.x = x + (y - first) * e.dx;
+                    add(e, y);
+                }
+            }
+        }
+    }
+}
+
+void PolygonFill::SortedEdgeTable::build(std::vector<Polygon> const& polygons, int h) {
+    // Count edges per row, then turn counts into where the next edge goes.
+    offset.assign(h + 1, 0);
+    forEachEdge(polygons, h, [&](Edge const&, int y) { ++offset[y + 1]; });
+    y_first = h;
+    y_last = -1;
+    for (int y = 0; y < h; ++y) {
+        if (offset[y + 1] > 0) {
+            y_first = std::min(y_first, y);
+            y_last = y;
+        }
+        offset[y + 1] += offset[y];
+    }
+    edges.resize(offset[h]);
+
+    // An edge stays active until y_max, so the last row with edges is
+    // not the last row to fill.
+    std::vector<int> next(offset.begin(), offset.end() - 1);
+    forEachEdge(polygons, h, [&](Edge const& e, int y) {
+        edges[next[y]++] = e;
+        y_last = std::max(y_last, e.y_max);
+    });
+}
@@ -0,0 +1,85 @@
+#include "../include/scene.h"
+#include <iostream>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+
+Scene::Scene(std::string const& path, bool reorder, bool lod)
+    : center(0)
+    , min(0)
+    , max(0) {
+    FILE *fp;
+    fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+        std::cout << "Failed to open file: " << path << std::endl;
+        return;
+    }
+
+    // Mesh paths are relative to the directory of the scene file.
+    auto slash = path.find_last_of("/\\");
+    auto directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+
+    char line_buffer[MAX_LINE_NUM];
+    char name[MAX_LINE_NUM];
+    float x, y, z;
+    int mesh, c, n;
+    int line = 0;
+    while (fgets(line_buffer, MAX_LINE_NUM, fp)) {
+        ++line;
+        if (strncmp(line_buffer, "mesh ", 5) == 0) {
+            if (sscanf(line_buffer, "mesh %255s", name) == 1) {
+                std::string mesh_path = name;
+                if (mesh_path[0] != '/' && mesh_path.find(':') == std::string::npos) {
+                    mesh_path = directory + mesh_path;
+                }
+                meshes.emplace_back(mesh_path, reorder, lod);
+            }
+        }
+        else if (strncmp(line_buffer, "instance ", 9) == 0) {
+            if (sscanf(line_buffer, "instance %d %f %f %f", &mesh, &x, &y, &z) == 4) {
+                if (mesh < 0 || mesh >= (int)meshes.size()) {
+                    std::cout << "Invalid mesh index at line " << line << ": " << path << std::endl;
+                    continue;
+                }
+                instances.push_back({ mesh, float3(x, y, z) });
+            }
+        }
+        else if (strncmp(line_buffer, "grid ", 5) == 0) {
+            if (sscanf(line_buffer, "grid %d %d %d", &mesh, &c, &n) == 3) {
+                if (mesh < 0 || mesh >= (int)meshes.size()) {
+                    std::cout << "Invalid mesh index at line " << line << ": " << path << std::endl;
+                    continue;
+                }
+                if (c < 0 || n < 1 || (long long)(2 * c + 1) * (2 * c + 1) * n > SCENE_MAX_GRID_INSTANCES) {
+                    std::cout << "Invalid grid size at line " << line << ": " << path << std::endl;
+                    continue;
+                }
+                addGrid(mesh, c, n);
+            }
+        }
+    }
+    fclose(fp);
+
+    updateBounds();
+}
+
+void Scene::addGrid(int mesh, int c, int n) {
+    for (int x = -c; x <= c; ++x) for (int y = -c; y <= c; ++y) for (int z = -1; z <= n - 2; ++z) {
+        instances.push_back({ mesh, float3(x, y, z) });
+    }
+}
+
+void Scene::updateBounds() {
+    if (instances.empty()) {
+        center = min = max = float3(0);
+        return;
+    }
+    min = float3(std::numeric_limits<float>::max());
+    max = float3(std::numeric_limits<float>::lowest());
+    for (auto const& instance : instances) {
+        auto const& mesh = meshes[instance.mesh];
+        min = float3::min(min, mesh.min + instance.translation);
+        max = float3::max(max, mesh.max + instance.translation);
+    }
+    center = (min + max) / 2;
+}
@@ -0,0 +1,418 @@
+#include "../include/mesh.h"
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+
+// Weight of the planes keeping boundary edges in place, relative to faces.
+#define LOD_BOUNDARY_WEIGHT 100.0
+// Collapses turning a face by more than this (cosine) are rejected.
+#define LOD_MIN_NORMAL_COSINE 0.2f
+// Largest distance of a level to the full detail mesh, relative to the
+// diagonal of its bounding box. Collapses beyond it are rejected.
+#define LOD_MAX_ERROR 0.01
+// A level whose bounding box moves by more than this, relative to the
+// diagonal, is dropped.
+#define LOD_MAX_BOUNDS_ERROR 0.02
+
+/**
+ * Error quadric of Garland and Heckbert's "Surface Simplification Using
+ * Quadric Error Metrics". Sum of squared distances to a set of planes,
+ * stored as the upper triangle of a symmetric 4x4 matrix.
+ */
+struct Quadric {
+    double q[10] = {};  // xx xy xz xw yy yz yw zz zw ww
+    double weight = 0;  // sum of the plane weights
+
+    Quadric() = default;
+    // Plane n . v + d = 0 with a unit normal, scaled by weight.
+    Quadric(float3 const& n, double d, double weight) {
+        double a = n.x, b = n.y, c = n.z;
+        q[0] = a * a; q[1] = a * b; q[2] = a * c; q[3] = a * d;
+        q[4] = b * b; q[5] = b * c; q[6] = b * d;
+        q[7] = c * c; q[8] = c * d;
+        q[9] = d * d;
+        for (auto & x : q) x *= weight;
+        this->weight = weight;
+    }
+
+    Quadric& operator+= (Quadric const& other) {
+        for (int i = 0; i < 10; ++i) q[i] += other.q[i];
+        weight += other.weight;
+        return *this;
+    }
+
+    double error(float3 const& v) const {
+        double x = v.x, y = v.y, z = v.z;
+        return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+             + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+             + q[7] * z * z + 2 * q[8] * z
+             + q[9];
+    }
+
+    // Weighted mean of the squared distances, comparable between quadrics.
+    double distance2(float3 const& v) const {
+        return weight > 0 ? std::max(error(v) / weight, 0.0) : 0.0;
+    }
+
+    // Position of minimal error, false if the system is close to singular.
+    bool optimum(float3 & v) const {
+        double det = q[0] * (q[4] * q[7] - q[5] * q[5])
+                   - q[1] * (q[1] * q[7] - q[5] * q[2])
+                   + q[2] * (q[1] * q[5] - q[4] * q[2]);
+        double scale = q[0] + q[4] + q[7];
+        if (std::abs(det) <= 1e-9 * scale * scale * scale) return false;
+        // Cramer's rule for A v = -b.
+        double bx = -q[3], by = -q[6], bz = -q[8];
+        double dx = bx * (q[4] * q[7] - q[5] * q[5])
+                  - q[1] * (by * q[7] - q[5] * bz)
+                  + q[2] * (by * q[5] - q[4] * bz);
+        double dy = q[0] * (by * q[7] - bz * q[5])
+                  - bx * (q[1] * q[7] - q[5] * q[2])
+                  + q[2] * (q[1] * bz - by * q[2]);
+        double dz = q[0] * (q[4] * bz - q[5] * by)
+                  - q[1] * (q[1] * bz - by * q[2])
+                  + bx * (q[1] * q[5] - q[4] * q[2]);
+        v = float3(dx / det, dy / det, dz / det);
+        return true;
+    }
+};
+
+struct Collapse {
+    double cost;
+    double distance2;   // squared distance of position to the merged planes
+    int a, b;
+    int version_a, version_b;
+    float3 position;
+
+    bool operator> (Collapse const& other) const { return cost > other.cost; }
+};
+
+static float3 faceNormal(float3 const& v0, float3 const& v1, float3 const& v2) {
+    return (v1 - v0).cross(v2 - v0);
+}
+
+/**
+ * Replaces vertices at the same position by a single one, so that faces split
+ * along seams or stored as a soup are simplified as one surface. Triangles
+ * left degenerate are dropped, source follows indices.
+ */
+static void weld(std::vector<float3> const& vertices,
+                 std::vector<int3> & indices,
+                 std::vector<int> & source) {
+    std::vector<int> order(vertices.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto less = [&](int a, int b) {
+        auto const& u = vertices[a];
+        auto const& v = vertices[b];
+        return u.x != v.x ? u.x < v.x : u.y != v.y ? u.y < v.y : u.z < v.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+    std::vector<int> remap(vertices.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        bool same = i > 0 && !less(order[i - 1], order[i]);
+        remap[order[i]] = same ? remap[order[i - 1]] : order[i];
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < indices.size(); ++i) {
+        auto t = indices[i];
+        for (int j = 0; j < 3; ++j) t[j] = remap[t[j]];
+        if (t[0] == t[1] || t[1] == t[2] || t[2] == t[0]) continue;
+        indices[kept] = t;
+        source[kept] = source[i];
+        ++kept;
+    }
+    indices.resize(kept);
+    source.resize(kept);
+}
+
+/**
+ * Collapses edges in order of increasing quadric error until at most target
+ * triangles are left, or no edge can be collapsed without flipping a face or
+ * moving the surface by more than max_error. Removed triangles and unused
+ * vertices are dropped, source follows indices. Returns the largest distance
+ * of a collapsed vertex to the planes it replaces.
+ */
+static double simplify(std::vector<float3> & vertices,
+                       std::vector<int3> & indices,
+                       std::vector<int> & source,
+                       int target,
+                       double max_error) {
+    weld(vertices, indices, source);
+    int vertex_num = vertices.size();
+    int triangle_num = indices.size();
+
+    std::vector<Quadric> quadrics(vertex_num);
+    std::vector<std::vector<int>> faces(vertex_num);
+    for (int i = 0; i < triangle_num; ++i) {
+        auto const& t = indices[i];
+        for (int j = 0; j < 3; ++j) faces[t[j]].push_back(i);
+        auto n = faceNormal(vertices[t[0]], vertices[t[1]], vertices[t[2]]);
+        auto length = std::sqrt(n.dot(n));
+        if (length == 0) continue;
+        n = n / length;
+        // Weighted by area, so that small faces do not pin large regions.
+        Quadric plane(n, -n.dot(vertices[t[0]]), length * 0.5);
+        for (int j = 0; j < 3; ++j) quadrics[t[j]] += plane;
+    }
+
+    // Edges as (smaller vertex, larger vertex, face), sorted so that
+    // an edge of only one face is on the boundary.
+    std::vector<int3> edges;
+    edges.reserve(triangle_num * 3);
+    for (int i = 0; i < triangle_num; ++i) {
+        auto const& t = indices[i];
+        for (int j = 0; j < 3; ++j) {
+            auto a = t[j], b = t[(j + 1) % 3];
+            edges.emplace_back(std::min(a, b), std::max(a, b), i);
+        }
+    }
+    std::sort(edges.begin(), edges.end(), [](int3 const& e0, int3 const& e1) {
+        return e0.x != e1.x ? e0.x < e1.x : e0.y < e1.y;
+    });
+    for (size_t i = 0; i < edges.size(); ++i) {
+        bool first = i == 0 || edges[i - 1].x != edges[i].x || edges[i - 1].y != edges[i].y;
+        bool last = i + 1 == edges.size() || edges[i + 1].x != edges[i].x || edges[i + 1].y != edges[i].y;
+        if (!first || !last) continue;
+        // Plane through the boundary edge, perpendicular to its face.
+        auto const& t = indices[edges[i].z];
+        auto v0 = vertices[edges[i].x];
+        auto e = vertices[edges[i].y] - v0;
+        auto n = e.cross(faceNormal(vertices[t[0]], vertices[t[1]], vertices[t[2]]));
+        auto length = std::sqrt(n.dot(n));
+        if (length == 0) continue;
+        n = n / length;
+        Quadric plane(n, -n.dot(v0), LOD_BOUNDARY_WEIGHT * e.dot(e));
+        quadrics[edges[i].x] += plane;
+        quadrics[edges[i].y] += plane;
+    }
+
+    std::vector<int> version(vertex_num, 0);
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+    auto push = [&](int a, int b) {
+        auto q = quadrics[a];
+        q += quadrics[b];
+        Collapse c = { 0.0, 0.0, a, b, version[a], version[b], float3(0) };
+        if (!q.optimum(c.position)) {
+            // Best of the end points and the midpoint.
+            float3 candidates[3] = { vertices[a], vertices[b], (vertices[a] + vertices[b]) / 2 };
+            c.cost = std::numeric_limits<double>::max();
+            for (auto const& p : candidates) {
+                auto cost = q.error(p);
+                if (cost < c.cost) { c.cost = cost; c.position = p; }
+            }
+        }
+        else {
+            c.cost = q.error(c.position);
+        }
+        c.distance2 = q.distance2(c.position);
+        heap.push(c);
+    };
+    for (size_t i = 0; i < edges.size(); ++i) {
+        if (i > 0 && edges[i - 1].x == edges[i].x && edges[i - 1].y == edges[i].y) continue;
+        push(edges[i].x, edges[i].y);
+    }
+
+    std::vector<char> removed(triangle_num, 0);
+    std::vector<int> neighbors;
+    double max_distance2 = max_error * max_error;
+    double error2 = 0;
+    int live = triangle_num;
+    while (live > target && !heap.empty()) {
+        auto c = heap.top();
+        heap.pop();
+        auto a = c.a, b = c.b;
+        // Stale, an end point moved or was collapsed since.
+        if (c.version_a != version[a] || c.version_b != version[b]) continue;
+        // Too far from the surface, kept until a neighbor moves.
+        if (c.distance2 > max_distance2) continue;
+
+        // Faces kept by the collapse must not flip or degenerate.
+        bool flips = false;
+        for (auto v : { a, b }) {
+            for (auto f : faces[v]) {
+                if (removed[f]) continue;
+                auto const& t = indices[f];
+                bool has_a = t[0] == a || t[1] == a || t[2] == a;
+                bool has_b = t[0] == b || t[1] == b || t[2] == b;
+                if (has_a && has_b) continue;
+                float3 p[3];
+                for (int j = 0; j < 3; ++j) p[j] = (t[j] == a || t[j] == b) ? c.position : vertices[t[j]];
+                auto before = faceNormal(vertices[t[0]], vertices[t[1]], vertices[t[2]]);
+                auto after = faceNormal(p[0], p[1], p[2]);
+                auto limit = LOD_MIN_NORMAL_COSINE * std::sqrt(before.dot(before) * after.dot(after));
+                if (after.dot(before) <= limit) {
+                    flips = true;
+                    break;
+                }
+            }
+            if (flips) break;
+        }
+        if (flips) continue;
+
+        // Move a to the collapsed position and replace b by a.
+        error2 = std::max(error2, c.distance2);
+        vertices[a] = c.position;
+        quadrics[a] += quadrics[b];
+        ++version[a];
+        ++version[b];
+        for (auto f : faces[b]) {
+            if (removed[f]) continue;
+            auto & t = indices[f];
+            if (t[0] == a || t[1] == a || t[2] == a) {
+                removed[f] = 1;
+                --live;
+                continue;
+            }
+            for (int j = 0; j < 3; ++j) if (t[j] == b) t[j] = a;
+            faces[a].push_back(f);
+        }
+        faces[b].clear();
+        faces[a].erase(std::remove_if(faces[a].begin(), faces[a].end(),
+                                      [&](int f) { return removed[f] != 0; }), faces[a].end());
+
+        neighbors.clear();
+        for (auto f : faces[a]) {
+            for (int j = 0; j < 3; ++j) if (indices[f][j] != a) neighbors.push_back(indices[f][j]);
+        }
+        std::sort(neighbors.begin(), neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+        for (auto v : neighbors) push(a, v);
+    }
+
+    // Drop removed triangles and unused vertices.
+    std::vector<int> remap(vertex_num, -1);
+    std::vector<float3> kept_vertices;
+    std::vector<int3> kept_indices;
+    std::vector<int> kept_source;
+    for (int i = 0; i < triangle_num; ++i) {
+        if (removed[i]) continue;
+        auto t = indices[i];
+        for (int j = 0; j < 3; ++j) {
+            if (remap[t[j]] < 0) {
+                remap[t[j]] = kept_vertices.size();
+                kept_vertices.push_back(vertices[t[j]]);
+            }
+            t[j] = remap[t[j]];
+        }
+        kept_indices.push_back(t);
+        kept_source.push_back(source[i]);
+    }
+    vertices.swap(kept_vertices);
+    indices.swap(kept_indices);
+    source.swap(kept_source);
+    return std::sqrt(error2);
+}
+
+// FNV-1a of the full detail mesh, a cache built from another mesh is ignored.
+static unsigned int meshChecksum(std::vector<float3> const& vertices, std::vector<int3> const& indices) {
+    unsigned int hash = 2166136261u;
+    auto add = [&](void const* data, size_t size) {
+        auto bytes = static_cast<unsigned char const*>(data);
+        for (size_t i = 0; i < size; ++i) hash = (hash ^ bytes[i]) * 16777619u;
+    };
+    add(vertices.data(), vertices.size() * sizeof(float3));
+    add(indices.data(), indices.size() * sizeof(int3));
+    return hash;
+}
+
+void TriangleMesh::buildLODs(std::string const& cache_path) {
+    lods.clear();
+    auto checksum = meshChecksum(vertices, indices);
+    if (loadLODs(cache_path, checksum)) return;
+
+    auto extent = max - min;
+    double diagonal = std::sqrt(extent.dot(extent));
+    double max_error = LOD_MAX_ERROR * diagonal;
+    // Errors add up from level to level, each level spends what is left.
+    double error = 0;
+    for (int l = 1; l < LOD_LEVELS; ++l) {
+        auto const& finer = level(l - 1);
+        int target = finer.indices.size() / LOD_REDUCTION;
+        if (target < LOD_MIN_TRIANGLES) break;
+
+        auto level_vertices = finer.vertices;
+        auto level_indices = finer.indices;
+        auto level_source = finer.source;
+        error += simplify(level_vertices, level_indices, level_source, target, max_error - error);
+        // Stop once collapses are blocked, the level would not be much coarser.
+        if (level_indices.size() * 2 > finer.indices.size()) break;
+        if (error > max_error) break;
+        lods.emplace_back(level_vertices, level_indices, level_source);
+        // Collapses bounded per edge can still shrink thin parts away.
+        auto const& lod = lods.back();
+        auto bound = LOD_MAX_BOUNDS_ERROR * diagonal;
+        bool within = true;
+        for (int i = 0; i < 3; ++i) {
+            within &= std::abs(lod.min[i] - min[i]) <= bound && std::abs(lod.max[i] - max[i]) <= bound;
+        }
+        if (!within) {
+            lods.pop_back();
+            break;
+        }
+    }
+    saveLODs(cache_path, checksum);
+}
+
+bool TriangleMesh::loadLODs(std::string const& cache_path, unsigned int checksum) {
+    FILE *fp;
+    fp = fopen(cache_path.c_str(), "rb");
+    if (fp == nullptr) return false;
+
+    char magic[4];
+    unsigned int header[3];
+    if (fread(magic, 1, 4, fp) != 4 || std::memcmp(magic, "ZBLD", 4) != 0
+        || fread(header, sizeof(unsigned int), 3, fp) != 3
+        || header[0] != LOD_CACHE_VERSION || header[1] != checksum || header[2] >= LOD_LEVELS) {
+        fclose(fp);
+        return false;
+    }
+
+    for (unsigned int l = 0; l < header[2]; ++l) {
+        unsigned int size[2];
+        if (fread(size, sizeof(unsigned int), 2, fp) != 2) break;
+        std::vector<float3> level_vertices(size[0]);
+        std::vector<int3> level_indices(size[1]);
+        std::vector<int> level_source(size[1]);
+        if (fread(level_vertices.data(), sizeof(float3), size[0], fp) != size[0]
+            || fread(level_indices.data(), sizeof(int3), size[1], fp) != size[1]
+            || fread(level_source.data(), sizeof(int), size[1], fp) != size[1]) break;
+        bool valid = true;
+        for (size_t i = 0; i < level_indices.size() && valid; ++i) {
+            for (int j = 0; j < 3; ++j) valid &= level_indices[i][j] >= 0 && level_indices[i][j] < (int)size[0];
+            valid &= level_source[i] >= 0 && level_source[i] < (int)indices.size();
+        }
+        if (!valid) break;
+        lods.emplace_back(level_vertices, level_indices, level_source);
+    }
+    fclose(fp);
+
+    if (lods.size() == header[2]) return true;
+    std::cout << "Invalid level of detail cache: " << cache_path << std::endl;
+    lods.clear();
+    return false;
+}
+
+void TriangleMesh::saveLODs(std::string const& cache_path, unsigned int checksum) const {
+    FILE *fp;
+    fp = fopen(cache_path.c_str(), "wb");
+    if (fp == nullptr) {
+        std::cout << "Failed to open file: " << cache_path << std::endl;
+        return;
+    }
+    unsigned int header[3] = { LOD_CACHE_VERSION, checksum, (unsigned int)lods.size() };
+    fwrite("ZBLD", 1, 4, fp);
+    fwrite(header, sizeof(unsigned int), 3, fp);
+    for (auto const& lod : lods) {
+        unsigned int size[2] = { (unsigned int)lod.vertices.size(), (unsigned int)lod.indices.size() };
+        fwrite(size, sizeof(unsigned int), 2, fp);
+        fwrite(lod.vertices.data(), sizeof(float3), size[0], fp);
+        fwrite(lod.indices.data(), sizeof(int3), size[1], fp);
+        fwrite(lod.source.data(), sizeof(int), size[1], fp);
+    }
+    fclose(fp);
+}
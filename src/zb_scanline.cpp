@@ -1,39 +1,50 @@
 #include "../include/zb_scanline.h"
+#include <algorithm>
+#include <cmath>
 
 using Edge = ZBScanline::SortedEdgeTable::Edge;
 static bool compareEdge(Edge const& first, Edge const& second) {
     if (first.id != second.id) {
         return first.id < second.id;
-    } else {
+    } else if (first.x != second.x) {
         return first.x < second.x;
+    } else {
+        // Edges meeting at a vertex, the order must not depend on the
+        // order edges were added in, which differs between bands.
+        return first.dx < second.dx;
     }
 }
 
-void ZBScanline::drawMesh(TriangleMesh const& mesh,
-                          std::vector<colorf> const& colors,
+bool ZBScanline::drawMesh(TriangleMesh const& mesh,
+                          std::vector<color8> const& colors,
                           float4x4 const& mvp,
-                          Image & image) {
-
-    std::vector<float3> ndc;
-    for (int i = 0; i < mesh.vertices.size(); ++i) {
-        auto v = float4(mesh.vertices[i], 1.0f);
-        v = mvp * v;
-        v.w = 1 / v.w;
-        v.x *= v.w;
-        v.y *= v.w;
-        v.z *= v.w;
-        ndc.push_back(float3(v));
+                          Image & image,
+                          unsigned int instance_id) {
+
+    mesh_visible = false;
+    STATS_INC(meshes_submitted);
+    STATS_ADD(triangles_submitted, mesh.indices.size());
+    STATS_BEGIN(transform);
+    auto visible = vertex_stage.process(mesh, mvp, cull_meshlets);
+    STATS_END(transform);
+
+    // Cull mesh if out of screen.
+    if (!visible) {
+        STATS_INC(meshes_culled);
+        return false;
     }
 
-    std::vector<Triangle> triangles;
+    STATS_BEGIN(build);
+    triangles.clear();
 
     // Setup triangles.
-    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+    auto const& ndc = vertex_stage.ndc;
+    for (auto const& triangle : vertex_stage.triangles) {
         Triangle t;
 
-        auto v0 = ndc[mesh.indices[i][0]];
-        auto v1 = ndc[mesh.indices[i][1]];
-        auto v2 = ndc[mesh.indices[i][2]];
+        auto v0 = ndc[triangle.v[0]];
+        auto v1 = ndc[triangle.v[1]];
+        auto v2 = ndc[triangle.v[2]];
 
         // Screen mapping.
         v0.x = (v0.x * 0.5f + 0.5f) * width;
@@ -49,7 +60,10 @@ void ZBScanline::drawMesh(TriangleMesh const& mesh,
 
         // Cull subpixel triangles.
         auto area = edgeFunction2D(v0, v1, v2);
-        if (area == 0) continue;
+        if (area == 0) {
+            STATS_INC(triangles_degenerate);
+            continue;
+        }
 
         // Store z value.
         t.z[0] = v0.z;
@@ -61,7 +75,10 @@ void ZBScanline::drawMesh(TriangleMesh const& mesh,
         float3 e02 = v2 - v0;
         float3 n = e01.cross(e02);
 
-        if (n.z < 0) continue;
+        if (n.z < 0) {
+            STATS_INC(triangles_backface_culled);
+            continue;
+        }
 
         // Surface of the triangle is defined by:
         // s_x * x + s_y * y + s_z * z = s_w
@@ -69,54 +86,65 @@ void ZBScanline::drawMesh(TriangleMesh const& mesh,
         t.surface.y = n.y;
         t.surface.z = n.z;
         t.surface.w = n.dot(v0);
-        t.id = i;
+        t.id = triangle.id;
 
         triangles.push_back(t);
     }
 
-    SortedEdgeTable SET(triangles, width, height);
+    if (triangles.empty()) {
+        STATS_END(build);
+        return false;
+    }
 
-    int y_min = SET.min.y;
-    int y_max = SET.max.y;
-    std::list<SortedEdgeTable::Edge> AEL;
-    std::vector<float> z_buffer(image.width);
-    // Scan the bounding area of the polygon.
-    for (int y = y_min; y <= y_max; ++y) {
-        for (int x = 0; x < image.width; ++x) {
-            z_buffer[x] = 1.0f;
+    SET.build(triangles, width, height, pool);
+    STATS_END(build);
+
+    STATS_BEGIN(raster);
+    // Bands take turns on the threads, each thread scans with its own state.
+    pool.run(SET.band_num, [&](int k, int worker) {
+        auto & band = bands[worker];
+        band.AEL.clear();
+        for (int chunk = 0; chunk < pool.size(); ++chunk) {
+            for (auto const& e : SET.seeds[chunk * SET.band_num + k]) band.AEL.push_back(e);
         }
+        int y0 = SET.y_first + k * SCANLINE_BAND_HEIGHT;
+        int y1 = std::min(y0 + SCANLINE_BAND_HEIGHT - 1, SET.y_last);
+        drawBand(band, y0, y1, colors, image, instance_id);
+    });
+    for (auto & band : bands) {
+        mesh_visible |= band.visible;
+        STATS_ADD(pixels_tested, band.pixels_tested);
+        STATS_ADD(pixels_written, band.pixels_written);
+        band.visible = false;
+        band.pixels_tested = 0;
+        band.pixels_written = 0;
+    }
+    STATS_END(raster);
+    return mesh_visible;
+}
 
+void ZBScanline::drawBand(Band & band, int y0, int y1, std::vector<color8> const& colors,
+                          Image & image, unsigned int instance_id) {
+    auto & AEL = band.AEL;
+    for (int y = y0; y <= y1; ++y) {
         // Append new edges.
-        for (size_t j = 0; j < SET.table[y - y_min].size(); ++j) {
-            SortedEdgeTable::Edge e = SET.table[y - y_min][j];
-            AEL.push_back(e);
+        for (int i = SET.offset[y - SET.min.y]; i < SET.offset[y - SET.min.y + 1]; ++i) {
+            AEL.push_back(SET.edges[i]);
         }
 
-        if (y >= 0 && y < image.height) {
-            // Sort edges by x.
-            AEL.sort(compareEdge);
-            assert(AEL.size() % 2 == 0);
-            // Fill pixels between every pair of edges.
-            auto e0 = AEL.begin();
-            auto e1 = std::next(e0);
-            while (e0 != AEL.end()) {
-                int x = ftoi(e0->x);
-                int x_max = ftoi(e1->x);
-                float z = e0->z;
-                while (x <= x_max) {
-                    if (z >= -1 && z <= 1 && x >= 0 && x < image.width) {
-                        if (z < z_buffer[x]) {
-                            z_buffer[x] = z;
-                            image.setPixel(x, y, colors[e0->id]);
-                        }
-                    }
-                    z += e0->dzdx;
-                    ++x;
-                }
-                e0 = std::next(e1);
-                e1 = std::next(e0);
-            }
+        // Sort edges by x.
+        AEL.sort(compareEdge);
+        assert(AEL.size() % 2 == 0);
+        // Every pair of edges bounds the span of a triangle.
+        band.spans.clear();
+        auto e0 = AEL.begin();
+        auto e1 = std::next(e0);
+        while (e0 != AEL.end()) {
+            addSpan(band, ftoi(e0->x), ftoi(e1->x), e0->z, e0->dzdx, e0->id);
+            e0 = std::next(e1);
+            e1 = std::next(e0);
         }
+        drawSpans(band, y, colors, image, instance_id);
 
         // Update x in edges.
         for (auto iter = AEL.begin(); iter != AEL.end(); ++iter) {
@@ -126,58 +154,232 @@ void ZBScanline::drawMesh(TriangleMesh const& mesh,
         // Remove used edges.
         AEL.remove_if([=](SortedEdgeTable::Edge e){ return e.y_max == y; });
     }
-    AEL.clear();
 }
 
-ZBScanline::SortedEdgeTable::SortedEdgeTable(std::vector<Triangle> const& tris, int w, int h) {
-    int const tri_num = tris.size();
-    int const vn = 3; // Here we consider only triangles.
-    initTable(tris);
-    for (int i = 0; i < tri_num; ++i) {
-        for (int j = 0; j < vn; ++j) {
-            Edge e;
-            int v0 = j;
-            int v1 = (j + 1) % vn;
-            if (tris[i].v[v0].y == tris[i].v[v1].y) continue;
-            if (tris[i].v[v0].y > tris[i].v[v1].y) {
-                // Use the vertex with smaller y as v0.
-                std::swap(v0, v1);
+void ZBScanline::addSpan(Band & band, int x0, int x1, float z, float dzdx, int id) {
+    Span span = { std::max(x0, 0), std::min(x1, width - 1), x0, z, dzdx, id };
+    if (span.x0 > span.x1) return;
+
+    // Pixels outside the depth range are not drawn. Depth is linear, the
+    // span is inside if both ends are, otherwise solve for the range and
+    // fix rounding at its ends.
+    auto inside = [&](int x) {
+        auto d = span.depth(x);
+        return d >= -1 && d <= 1;
+    };
+    if (!inside(span.x0) || !inside(span.x1)) {
+        if (dzdx == 0) return;
+        auto a = x0 + (-1 - z) / dzdx;
+        auto b = x0 + (1 - z) / dzdx;
+        auto lo = std::max(std::min(a, b), (float)span.x0);
+        auto hi = std::min(std::max(a, b), (float)span.x1);
+        if (lo > hi + 1) return;
+        span.x0 = std::max(span.x0, (int)std::ceil(lo) - 1);
+        span.x1 = std::min(span.x1, (int)std::floor(hi) + 1);
+        while (span.x0 <= span.x1 && !inside(span.x0)) ++span.x0;
+        while (span.x1 >= span.x0 && !inside(span.x1)) --span.x1;
+        if (span.x0 > span.x1) return;
+    }
+    band.spans.push_back(span);
+}
+
+void ZBScanline::drawSpans(Band & band, int y, std::vector<color8> const& colors, Image & image, unsigned int instance_id) {
+    auto & spans = band.spans;
+    auto & sorted_spans = band.sorted_spans;
+    auto & span_offset = band.span_offset;
+    auto & active = band.active;
+    if (spans.empty()) return;
+    // Counting sort by first pixel, over the range of first pixels.
+    int x_lo = width, x_hi = 0;
+    for (auto const& span : spans) {
+        x_lo = std::min(x_lo, span.x0);
+        x_hi = std::max(x_hi, span.x0);
+    }
+    span_offset.assign(x_hi - x_lo + 2, 0);
+    for (auto const& span : spans) ++span_offset[span.x0 - x_lo + 1];
+    for (int i = 0; i <= x_hi - x_lo; ++i) span_offset[i + 1] += span_offset[i];
+    sorted_spans.resize(spans.size());
+    for (auto const& span : spans) sorted_spans[span_offset[span.x0 - x_lo]++] = span;
+    spans.swap(sorted_spans);
+
+    // Ties go to the lower triangle id, which was drawn first by the per-pixel test.
+    auto closer = [&](Span const& a, Span const& b, int x) {
+        auto za = a.depth(x);
+        auto zb = b.depth(x);
+        return za < zb || (za == zb && a.id < b.id);
+    };
+
+    active.clear();
+    size_t next = 0;
+    int x = 0;
+    while (next < spans.size() || !active.empty()) {
+        if (active.empty()) x = spans[next].x0;
+        while (next < spans.size() && spans[next].x0 <= x) active.push_back(next++);
+
+        // Covering spans do not change until end.
+        int end = next < spans.size() ? spans[next].x0 - 1 : width - 1;
+        for (auto i : active) end = std::min(end, spans[i].x1);
+
+        while (x <= end) {
+            band.pixels_tested += active.size();
+            auto nearest = active[0];
+            for (auto i : active) {
+                if (closer(spans[i], spans[nearest], x)) nearest = i;
             }
-            e.y_max = tris[i].v[v1].y;
-            e.dx = (float)(tris[i].v[v1].x - tris[i].v[v0].x) / (tris[i].v[v1].y - tris[i].v[v0].y);
-            e.x = itof(tris[i].v[v0].x);
-            e.id = tris[i].id;
-            if (tris[i].surface.z == 0) {
-                // The surface is parallel to z-axis.
-                e.dzdx = e.dzdy = 0;
+            auto const& w = spans[nearest];
+
+            // Depths are linear, a span closer at the last pixel of the
+            // interval crosses the nearest one once, cut the interval there.
+            int last = end;
+            for (size_t j = 0; j < active.size() && last > x; ++j) {
+                auto i = active[j];
+                if (i == nearest || !closer(spans[i], w, last)) continue;
+                auto const& s = spans[i];
+                auto f0 = w.depth(x) - s.depth(x);
+                auto f1 = w.depth(last) - s.depth(last);
+                int p = f1 > f0 ? x + (int)((last - x) * (-f0 / (f1 - f0))) : last;
+                p = clamp(p, x + 1, last);
+                while (p > x + 1 && closer(s, w, p - 1)) --p;
+                while (p < last && !closer(s, w, p)) ++p;
+                last = p - 1;
+                ++band.pixels_tested;
             }
-            else {
-                e.dzdx = -tris[i].surface.x / tris[i].surface.z;
-                e.dzdy = -tris[i].surface.y / tris[i].surface.z;
+
+            band.pixels_written += last - x + 1;
+            band.visible = true;
+            if (count_overdraw) {
+                for (int p = x; p <= last; ++p) {
+                    overdraw.test(p, y);
+                    overdraw.write(p, y);
+                }
             }
-            e.dzdx /= (w / 2);
-            e.dzdy /= (h / 2);
-            e.z = tris[i].z[v0];
-
-            // Determine whether v0 is at a singularity position that is
-            // both edge connected to it is on the same side of the scanline.
-            int prev = (v0 - 1 + vn) % vn;
-            int next = (v0 + 1 + vn) % vn;
-            int y = tris[i].v[v0].y - min.y;
-            // If not at singularity position.
-            if ((tris[i].v[next].y - tris[i].v[v0].y) * (tris[i].v[prev].y - tris[i].v[v0].y) < 0) {
-                // move this vertex up by 1 to avoid handling this case when rasterizing.
-                e.x += e.dx;
-                e.z += e.dzdx * e.dx + e.dzdy;
-                ++y;
+            if (write_visibility) {
+                auto id = VisibilityBuffer::encode(instance_id, w.id);
+                for (int p = x; p <= last; ++p) visibility.write(p, y, id);
             }
-            
-            table[y].emplace_back(e);
+            if (!deferred) image.writeSpan(x, last, y, colors[w.id]);
+            x = last + 1;
         }
+
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [&](int i) { return spans[i].x1 < x; }), active.end());
     }
 }
 
-void ZBScanline::SortedEdgeTable::initTable(std::vector<Triangle> const& tris) {
+// Edges of a triangle and the rows where they become active, returns the number of edges.
+static int triangleEdges(ZBScanline::Triangle const& t, int w, int h, Edge * edges, int * rows) {
+    int const vn = 3; // Here we consider only triangles.
+    int count = 0;
+    for (int j = 0; j < vn; ++j) {
+        Edge e;
+        int v0 = j;
+        int v1 = (j + 1) % vn;
+        if (t.v[v0].y == t.v[v1].y) continue;
+        if (t.v[v0].y > t.v[v1].y) {
+            // Use the vertex with smaller y as v0.
+            std::swap(v0, v1);
+        }
+        e.y_max = t.v[v1].y;
+        e.dx = (float)(t.v[v1].x - t.v[v0].x) / (t.v[v1].y - t.v[v0].y);
+        e.x = itof(t.v[v0].x);
+        e.id = t.id;
+        if (t.surface.z == 0) {
+            // The surface is parallel to z-axis.
+            e.dzdx = e.dzdy = 0;
+        }
+        else {
+            e.dzdx = -t.surface.x / t.surface.z;
+            e.dzdy = -t.surface.y / t.surface.z;
+        }
+        e.dzdx /= (w / 2);
+        e.dzdy /= (h / 2);
+        e.z = t.z[v0];
+
+        // Determine whether v0 is at a singularity position that is
+        // both edge connected to it is on the same side of the scanline.
+        int prev = (v0 - 1 + vn) % vn;
+        int next = (v0 + 1 + vn) % vn;
+        int y = t.v[v0].y;
+        // If not at singularity position.
+        if ((t.v[next].y - t.v[v0].y) * (t.v[prev].y - t.v[v0].y) < 0) {
+            // move this vertex up by 1 to avoid handling this case when rasterizing.
+            e.x += e.dx;
+            e.z += e.dzdx * e.dx + e.dzdy;
+            ++y;
+        }
+        edges[count] = e;
+        rows[count] = y;
+        ++count;
+    }
+    return count;
+}
+
+void ZBScanline::SortedEdgeTable::build(std::vector<Triangle> const& tris, int w, int h, ThreadPool & pool) {
+    initTable(tris, h);
+    int const tri_num = tris.size();
+    int const row_num = max.y - min.y + 1;
+    int const chunk_num = pool.size();
+    auto chunkBegin = [&](int chunk) { return (int)((long long)tri_num * chunk / chunk_num); };
+
+    // Count edges of each row per chunk of triangles.
+    chunk_offset.assign(chunk_num * row_num, 0);
+    pool.run(chunk_num, [&](int chunk, int) {
+        auto count = chunk_offset.data() + chunk * row_num;
+        Edge e[3];
+        int rows[3];
+        for (int i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i) {
+            int n = triangleEdges(tris[i], w, h, e, rows);
+            for (int j = 0; j < n; ++j) ++count[rows[j] - min.y];
+        }
+    });
+
+    // Rows in order, chunks in order within a row.
+    offset.resize(row_num + 1);
+    int total = 0;
+    for (int y = 0; y < row_num; ++y) {
+        offset[y] = total;
+        for (int chunk = 0; chunk < chunk_num; ++chunk) {
+            auto & c = chunk_offset[chunk * row_num + y];
+            auto n = c;
+            c = total;
+            total += n;
+        }
+    }
+    offset[row_num] = total;
+    edges.resize(total);
+
+    // Scatter edges, and seed every band an edge is active at the start of.
+    seeds.resize(chunk_num * band_num);
+    for (auto & seed : seeds) seed.clear();
+    pool.run(chunk_num, [&](int chunk, int) {
+        auto next = chunk_offset.data() + chunk * row_num;
+        auto band_seeds = seeds.data() + chunk * band_num;
+        Edge e[3];
+        int rows[3];
+        for (int i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i) {
+            int n = triangleEdges(tris[i], w, h, e, rows);
+            for (int j = 0; j < n; ++j) {
+                edges[next[rows[j] - min.y]++] = e[j];
+                // From the first band starting after the edge's first row, the
+                // edge is advanced row by row as the serial scan would.
+                int k = rows[j] < y_first ? 0 : (rows[j] - y_first) / SCANLINE_BAND_HEIGHT + 1;
+                auto seed = e[j];
+                int y = rows[j];
+                for (; k < band_num; ++k) {
+                    int band_y = y_first + k * SCANLINE_BAND_HEIGHT;
+                    if (band_y > seed.y_max) break;
+                    for (; y < band_y; ++y) {
+                        seed.x += seed.dx;
+                        seed.z += seed.dzdx * seed.dx + seed.dzdy;
+                    }
+                    band_seeds[k].push_back(seed);
+                }
+            }
+        }
+    });
+}
+
+void ZBScanline::SortedEdgeTable::initTable(std::vector<Triangle> const& tris, int h) {
     // Get bounding of all triangles.
     min = { std::numeric_limits<int>::max(), std::numeric_limits<int>::max() };
     max = { std::numeric_limits<int>::min(), std::numeric_limits<int>::min() };
@@ -185,6 +387,8 @@ void ZBScanline::SortedEdgeTable::initTable(std::vector<Triangle> const& tris) {
         min = int2::min(min, tris[i].min());
         max = int2::max(max, tris[i].max());
     }
-    int table_size = max.y - min.y + 1;
-    table.resize(table_size);
+    // Only rows on screen are scanned.
+    y_first = std::max(min.y, 0);
+    y_last = std::min(max.y, h - 1);
+    band_num = y_last < y_first ? 0 : (y_last - y_first) / SCANLINE_BAND_HEIGHT + 1;
 }